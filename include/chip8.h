@@ -7,8 +7,37 @@
 #include "chip8_stack.h"
 #include "chip8_keyboard.h"
 #include "chip8_screen.h"
+#include "chip8_random.h"
+#include "chip8_instruction.h"
+#include "chip8_jit.h"
 #include <stddef.h>
 
+struct chip8_movie;
+struct chip8_telemetry;
+
+enum chip8_engine
+{
+    // Reference path: one cached instruction per chip8_step
+    CHIP8_ENGINE_INTERPRETER,
+    // Computed-goto dispatch loop running many instructions per call
+    CHIP8_ENGINE_THREADED,
+    // x86-64 translation of straight-line blocks, interpreter for everything else
+    CHIP8_ENGINE_JIT
+};
+
+enum chip8_run_result
+{
+    // All requested cycles were executed
+    CHIP8_RUN_CYCLES,
+    // The last executed cycle completed an emulated frame and ticked the timers
+    CHIP8_RUN_FRAME,
+    // Fx0A is waiting for a key, the rest of the budget passed idle up to at most
+    // the end of the frame and nothing more runs until chip8_keyboard_down
+    CHIP8_RUN_KEY_WAIT,
+    // PC reached a breakpoint, the instruction there has not been executed
+    CHIP8_RUN_BREAKPOINT
+};
+
 struct chip8
 {
     struct chip8_memory memory;
@@ -16,9 +45,47 @@ struct chip8
     struct chip8_registers registers;
     struct chip8_keyboard keyboard;
     struct chip8_screen screen;
+    struct chip8_random random;
+    // Like memory, backed page by page and owned; a machine is never struct-copied
+    struct chip8_instruction_cache instructions;
+    enum chip8_engine engine;
+    struct chip8_jit* jit;
+
+    // Emulated time: the delay and sound timers tick once every cycles_per_frame instructions
+    unsigned long long cycles;
+    unsigned long long frames;
+    unsigned int cycles_per_frame;
+    unsigned int frame_cycles;
+
+    bool key_wait;
+    // When set, every latched frame of input is appended to this movie
+    struct chip8_movie* movie;
+    // When set, counters are published here as the machine runs
+    struct chip8_telemetry* telemetry;
+    unsigned char breakpoints[CHIP8_MEMORY_SIZE / 8];
+    int total_breakpoints;
+};
+
+// Initial memory of a program, shareable read-only between machines
+struct chip8_image
+{
+    unsigned char memory[CHIP8_MEMORY_SIZE];
 };
 
-void chip8_init(struct chip8* chip8);
-void chip8_load(struct chip8* chip8, const char* buf, size_t size);
+bool chip8_init(struct chip8* chip8);
+void chip8_destroy(struct chip8* chip8);
+bool chip8_load(struct chip8* chip8, const char* buf, size_t size);
+bool chip8_load_file(struct chip8* chip8, const char* filename);
+void chip8_image_init(struct chip8_image* image, const char* buf, size_t size);
+bool chip8_image_load_file(struct chip8_image* image, const char* filename);
+void chip8_load_image(struct chip8* chip8, const struct chip8_image* image);
+void chip8_memory_write(struct chip8* chip8, int index, unsigned char val);
 void chip8_exec(struct chip8* chip8, unsigned short opcode);
+void chip8_decode(struct chip8_instruction* instruction, unsigned short opcode);
+const struct chip8_instruction* chip8_fetch(struct chip8* chip8, unsigned short address);
+void chip8_step(struct chip8* chip8);
+bool chip8_set_engine(struct chip8* chip8, enum chip8_engine engine);
+void chip8_set_breakpoint(struct chip8* chip8, unsigned short address, bool enabled);
+void chip8_set_cycles_per_frame(struct chip8* chip8, unsigned int cycles_per_frame);
+enum chip8_run_result chip8_run(struct chip8* chip8, unsigned int cycles);
 #endif
\ No newline at end of file
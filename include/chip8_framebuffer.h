@@ -0,0 +1,27 @@
+#ifndef CHIP8FRAMEBUFFER_H
+#define CHIP8FRAMEBUFFER_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "chip8_screen.h"
+
+// Triple buffer handing complete frames from the emulator thread to a renderer.
+// Neither side ever blocks: the writer owns back, the reader owns front and
+// they trade through middle with a single atomic exchange.
+struct chip8_framebuffer
+{
+    struct chip8_screen buffers[3];
+    atomic_uint middle;
+    unsigned int back;
+    unsigned int front;
+
+    // Rows changed since the reader last took a frame, owned by the writer
+    unsigned int pending_dirty;
+};
+
+void chip8_framebuffer_init(struct chip8_framebuffer* framebuffer);
+bool chip8_framebuffer_publish(struct chip8_framebuffer* framebuffer, struct chip8_screen* screen);
+struct chip8_screen* chip8_framebuffer_acquire(struct chip8_framebuffer* framebuffer);
+
+#endif
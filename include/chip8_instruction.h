@@ -0,0 +1,79 @@
+#ifndef CHIP8INSTRUCTION_H
+#define CHIP8INSTRUCTION_H
+
+#include <stdbool.h>
+#include "config.h"
+struct chip8;
+struct chip8_instruction;
+
+enum chip8_op
+{
+    CHIP8_OP_NOP,
+    CHIP8_OP_CLS,
+    CHIP8_OP_RET,
+    CHIP8_OP_JP,
+    CHIP8_OP_CALL,
+    CHIP8_OP_SE_BYTE,
+    CHIP8_OP_SNE_BYTE,
+    CHIP8_OP_SE_REG,
+    CHIP8_OP_LD_BYTE,
+    CHIP8_OP_ADD_BYTE,
+    CHIP8_OP_LD_REG,
+    CHIP8_OP_OR,
+    CHIP8_OP_AND,
+    CHIP8_OP_XOR,
+    CHIP8_OP_ADD_REG,
+    CHIP8_OP_SUB,
+    CHIP8_OP_SHR,
+    CHIP8_OP_SUBN,
+    CHIP8_OP_SHL,
+    CHIP8_OP_SNE_REG,
+    CHIP8_OP_LD_I,
+    CHIP8_OP_JP_V0,
+    CHIP8_OP_RND,
+    CHIP8_OP_DRW,
+    CHIP8_OP_SKP,
+    CHIP8_OP_SKNP,
+    CHIP8_OP_LD_VX_DT,
+    CHIP8_OP_LD_VX_K,
+    CHIP8_OP_LD_DT_VX,
+    CHIP8_OP_LD_ST_VX,
+    CHIP8_OP_ADD_I_VX,
+    CHIP8_OP_LD_F_VX,
+    CHIP8_OP_LD_B_VX,
+    CHIP8_OP_LD_MEM_VX,
+    CHIP8_OP_LD_VX_MEM,
+    CHIP8_TOTAL_OPS
+};
+
+typedef void (*chip8_instruction_handler)(struct chip8* chip8, const struct chip8_instruction* instruction);
+
+struct chip8_instruction
+{
+    // NULL when the slot has not been decoded yet
+    chip8_instruction_handler handler;
+    unsigned short nnn;
+    unsigned char op;
+    unsigned char x;
+    unsigned char y;
+    unsigned char kk;
+    unsigned char n;
+};
+
+// Decoded instructions indexed by the address they were fetched from. The
+// slots are reserved from the OS in one zero-filled mapping, so a machine is
+// only backed by the pages its program actually decodes into
+struct chip8_instruction_cache
+{
+    struct chip8_instruction* instructions;
+    // Bit p is set once a slot for memory page p has been written
+    unsigned int touched;
+};
+
+bool chip8_instruction_cache_init(struct chip8_instruction_cache* cache);
+void chip8_instruction_cache_destroy(struct chip8_instruction_cache* cache);
+void chip8_instruction_cache_clear(struct chip8_instruction_cache* cache);
+void chip8_instruction_cache_invalidate(struct chip8_instruction_cache* cache, int index);
+struct chip8_instruction* chip8_instruction_cache_slot(struct chip8_instruction_cache* cache, int address);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef CHIP8JIT_H
+#define CHIP8JIT_H
+
+#include <stdbool.h>
+#include "config.h"
+
+struct chip8;
+struct chip8_jit;
+
+// Returns NULL when the host is not x86-64 or executable memory is unavailable
+struct chip8_jit* chip8_jit_create(void);
+void chip8_jit_destroy(struct chip8_jit* jit);
+void chip8_jit_flush(struct chip8_jit* jit);
+void chip8_jit_invalidate(struct chip8_jit* jit, int index);
+unsigned int chip8_jit_exec(struct chip8* chip8, unsigned int cycles);
+
+#endif
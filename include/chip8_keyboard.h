@@ -2,17 +2,53 @@
 #define CHIP8KEYBOARD_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "config.h"
+
+// One host key code bound to a CHIP-8 key
+struct chip8_keyboard_binding
+{
+    int code;
+    unsigned char key;
+    bool bound;
+};
+
 struct chip8_keyboard
 {
-    bool keyboard[CHIP8_TOTAL_KEYS];
-    const char* keyboard_map;
+    // Written by the host thread: bit n is CHIP-8 key n. down holds the keys
+    // held right now, pressed and released collect edges until the next latch.
+    // All three share one word so the latch reads them as a single event
+    atomic_ullong keys;
+
+    // Owned by the core and latched once per frame, so a tap shorter than a
+    // frame still reads as held for one frame
+    unsigned short state;
+    unsigned short frame_pressed;
+    unsigned short frame_released;
+    // down as it was read by the latch, which state cannot tell apart from a tap
+    unsigned short frame_down;
+
+    // Fx0A: presses latched since the core started waiting
+    atomic_bool waiting;
+    unsigned short wait_pressed;
+
+    // Open-addressed table from full host key codes to CHIP-8 keys; a CHIP-8
+    // key may have any number of bindings
+    struct chip8_keyboard_binding bindings[CHIP8_KEYBOARD_MAP_SIZE];
+    int total_bindings;
 };
 
-void chip8_keyboard_set_map(struct chip8_keyboard* keyboard, const char* map);
-int chip8_keyboard_map(struct chip8_keyboard* keyboard, char key);
+void chip8_keyboard_set_map(struct chip8_keyboard* keyboard, const int* map);
+bool chip8_keyboard_bind(struct chip8_keyboard* keyboard, int code, int key);
+int chip8_keyboard_map(struct chip8_keyboard* keyboard, int code);
 void chip8_keyboard_down(struct chip8_keyboard* keyboard, int key);
 void chip8_keyboard_up(struct chip8_keyboard* keyboard, int key);
 bool chip8_keyboard_is_down(struct chip8_keyboard* keyboard, int key);
+void chip8_keyboard_latch(struct chip8_keyboard* keyboard);
+int chip8_keyboard_wait_key(struct chip8_keyboard* keyboard);
+bool chip8_keyboard_is_waiting(struct chip8_keyboard* keyboard);
+void chip8_keyboard_sync(struct chip8_keyboard* keyboard, unsigned short held);
+void chip8_keyboard_load_host(const struct chip8_keyboard* keyboard, unsigned short* down, unsigned short* pressed, unsigned short* released);
+void chip8_keyboard_store_host(struct chip8_keyboard* keyboard, unsigned short down, unsigned short pressed, unsigned short released);
 
 #endif
\ No newline at end of file
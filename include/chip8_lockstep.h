@@ -0,0 +1,54 @@
+#ifndef CHIP8LOCKSTEP_H
+#define CHIP8LOCKSTEP_H
+
+#include "chip8.h"
+
+// CHIP8_LOCKSTEP_LANES copies of one machine in structure-of-arrays form. Every
+// array is indexed by lane last, so the lanes' copies of a register or memory
+// byte are contiguous and one vector instruction updates all of them.
+// Lanes whose PC and opcode agree step together; the rest run one by one
+struct chip8_lockstep
+{
+    unsigned char memory[CHIP8_MEMORY_SIZE][CHIP8_LOCKSTEP_LANES];
+    unsigned char V[CHIP8_TOTAL_DATA_REGISTERS][CHIP8_LOCKSTEP_LANES];
+    unsigned short I[CHIP8_LOCKSTEP_LANES];
+    unsigned short PC[CHIP8_LOCKSTEP_LANES];
+    unsigned char delay_timer[CHIP8_LOCKSTEP_LANES];
+    unsigned char sound_timer[CHIP8_LOCKSTEP_LANES];
+    unsigned char SP[CHIP8_LOCKSTEP_LANES];
+
+    // Only touched one lane at a time, so these stay per lane
+    unsigned short stack[CHIP8_LOCKSTEP_LANES][CHIP8_TOTAL_STACK_DEPTH];
+    struct chip8_screen screens[CHIP8_LOCKSTEP_LANES];
+    struct chip8_random random[CHIP8_LOCKSTEP_LANES];
+
+    // Keypad held during the current frame, and Fx0A state. Bit n of the lane
+    // masks is lane n
+    unsigned short keys[CHIP8_LOCKSTEP_LANES];
+    unsigned short wait_pressed[CHIP8_LOCKSTEP_LANES];
+    unsigned int waiting;
+    unsigned int idle;
+
+    // Decoded instruction per address, reused while the opcode there matches
+    struct chip8_instruction decoded[CHIP8_MEMORY_SIZE];
+    unsigned short decoded_opcodes[CHIP8_MEMORY_SIZE];
+
+    unsigned int cycles_per_frame;
+    unsigned long long frames;
+    unsigned long long cycles;
+
+    // Set when the host has AVX2; otherwise every group runs one lane at a time
+    bool vector;
+
+    // Lane-instructions executed by the vector and the one-lane paths
+    unsigned long long vector_instructions;
+    unsigned long long scalar_instructions;
+};
+
+void chip8_lockstep_init(struct chip8_lockstep* lockstep, const struct chip8* prototype);
+void chip8_lockstep_seed(struct chip8_lockstep* lockstep, int lane, unsigned long long seed);
+void chip8_lockstep_set_keys(struct chip8_lockstep* lockstep, int lane, unsigned short keys);
+void chip8_lockstep_run_frame(struct chip8_lockstep* lockstep);
+void chip8_lockstep_extract(const struct chip8_lockstep* lockstep, int lane, struct chip8* chip8);
+
+#endif
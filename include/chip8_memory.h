@@ -1,14 +1,32 @@
 #ifndef CHIP8MEMORY_H
 #define CHIP8MEMORY_H
 
+#include <stdbool.h>
 #include "config.h"
+
+// Memory is a table of pages. Pages start out pointing into a read-only image
+// that any number of machines may share, and a page is copied into a private
+// allocation the first time it is written. A machine owning pages must not be
+// duplicated by plain struct assignment
 struct chip8_memory
 {
-    unsigned char memory[CHIP8_MEMORY_SIZE];
+    const unsigned char* pages[CHIP8_MEMORY_TOTAL_PAGES];
+    // Bit p is set when page p is a private copy
+    unsigned int owned;
+    // Bit b is set when block b of CHIP8_MEMORY_BLOCK_SIZE bytes was written
+    // since the last chip8_memory_fetch_dirty
+    unsigned long long dirty;
+    // Set once a write was dropped because its page could not be copied; the
+    // memory stays readable but no longer matches the program's writes
+    bool failed;
 };
 
-void chip8_memory_set(struct chip8_memory* memory, int index, unsigned char val);
-unsigned char chip8_memory_get(struct chip8_memory* memory,int index);
-unsigned short chip8_memory_get_short(struct chip8_memory* memory,int index);
+void chip8_memory_init(struct chip8_memory* memory, const unsigned char* image);
+void chip8_memory_destroy(struct chip8_memory* memory);
+bool chip8_memory_set(struct chip8_memory* memory, int index, unsigned char val);
+unsigned char chip8_memory_get(const struct chip8_memory* memory, int index);
+unsigned short chip8_memory_get_short(const struct chip8_memory* memory, int index);
+const unsigned char* chip8_memory_block(const struct chip8_memory* memory, int block);
+unsigned long long chip8_memory_fetch_dirty(struct chip8_memory* memory);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,50 @@
+#ifndef CHIP8MOVIE_H
+#define CHIP8MOVIE_H
+
+#include <stdbool.h>
+#include "config.h"
+
+#define CHIP8_MOVIE_MAGIC "C8MV"
+#define CHIP8_MOVIE_VERSION 1
+
+struct chip8;
+
+// One host key transition, applied just before the input latch at cycle
+struct chip8_movie_event
+{
+    unsigned long long cycle;
+    unsigned char key;
+    bool down;
+};
+
+// Keypad input of a session, rebuilt from what the core latched each frame so
+// that feeding it back through chip8_keyboard_down/up reproduces every latch
+// exactly. A movie starts from a freshly loaded ROM and carries the RNG state
+// and frame length it was recorded with
+struct chip8_movie
+{
+    unsigned long long random;
+    unsigned int cycles_per_frame;
+
+    struct chip8_movie_event* events;
+    int total_events;
+    int max_events;
+    // An event could not be stored, the recording no longer replays the session
+    bool incomplete;
+
+    // Playback position
+    int next;
+};
+
+void chip8_movie_init(struct chip8_movie* movie);
+void chip8_movie_destroy(struct chip8_movie* movie);
+void chip8_movie_begin(struct chip8_movie* movie, const struct chip8* chip8);
+void chip8_movie_record(struct chip8_movie* movie, const struct chip8* chip8);
+void chip8_movie_truncate(struct chip8_movie* movie, unsigned long long cycle);
+bool chip8_movie_save(const struct chip8_movie* movie, const char* filename);
+bool chip8_movie_load(struct chip8_movie* movie, const char* filename);
+void chip8_movie_start(struct chip8_movie* movie, struct chip8* chip8);
+void chip8_movie_play(struct chip8_movie* movie, struct chip8* chip8);
+bool chip8_movie_is_done(const struct chip8_movie* movie);
+
+#endif
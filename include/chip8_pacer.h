@@ -0,0 +1,21 @@
+#ifndef CHIP8PACER_H
+#define CHIP8PACER_H
+
+#include <stdbool.h>
+#include <time.h>
+#include "config.h"
+
+// Sleeps between emulated frames against absolute deadlines, so wake-up
+// latency never accumulates into drift
+struct chip8_pacer
+{
+    struct timespec deadline;
+    long period_ns;
+};
+
+void chip8_pacer_init(struct chip8_pacer* pacer, unsigned int frames_per_second);
+void chip8_pacer_reset(struct chip8_pacer* pacer);
+void chip8_pacer_wait(struct chip8_pacer* pacer);
+bool chip8_pacer_is_due(struct chip8_pacer* pacer);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef CHIP8RANDOM_H
+#define CHIP8RANDOM_H
+
+#include "config.h"
+struct chip8_random
+{
+    unsigned long long state;
+};
+
+void chip8_random_seed(struct chip8_random* random, unsigned long long seed);
+unsigned char chip8_random_byte(struct chip8_random* random);
+
+#endif
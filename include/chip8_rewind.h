@@ -0,0 +1,46 @@
+#ifndef CHIP8REWIND_H
+#define CHIP8REWIND_H
+
+#include <stdbool.h>
+#include "config.h"
+#include "chip8_state.h"
+
+// Worst case for one run-length encoded snapshot: a literal header every 128 bytes
+#define CHIP8_REWIND_MAX_RECORD_SIZE (sizeof(struct chip8_state) + sizeof(struct chip8_state) / 128 + 1)
+
+struct chip8_rewind_frame
+{
+    unsigned int offset;
+    unsigned int size;
+    bool keyframe;
+};
+
+// History of per-frame snapshots. Every CHIP8_REWIND_KEYFRAME_INTERVAL frames
+// a whole state is stored, the frames in between only store the XOR against
+// the frame before; both are run-length encoded into one byte ring. When
+// the ring fills up the oldest keyframe is dropped along with its deltas.
+// Rewinding writes into the machine's own memory, so either one may be
+// destroyed first. This is too large for the stack, allocate it
+struct chip8_rewind
+{
+    unsigned char buffer[CHIP8_REWIND_BUFFER_SIZE];
+    unsigned int head;
+
+    struct chip8_rewind_frame frames[CHIP8_REWIND_MAX_FRAMES];
+    int first;
+    int total_frames;
+    // Deltas recorded since the newest keyframe
+    int since_keyframe;
+
+    // State of the newest frame, the base for the next delta
+    struct chip8_state last;
+    struct chip8_state capture;
+    unsigned char record[CHIP8_REWIND_MAX_RECORD_SIZE];
+};
+
+void chip8_rewind_init(struct chip8_rewind* rewind);
+void chip8_rewind_push(struct chip8_rewind* rewind, const struct chip8* chip8);
+bool chip8_rewind_back(struct chip8_rewind* rewind, struct chip8* chip8);
+unsigned int chip8_rewind_size(const struct chip8_rewind* rewind);
+
+#endif
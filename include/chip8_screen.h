@@ -3,13 +3,23 @@
 
 #include <stdbool.h>
 #include "config.h"
+// Each row is packed into one 64 bit word with x = 0 in the most significant bit,
+// which relies on CHIP8_WIDTH being 64
 struct chip8_screen
 {
-    bool pixels[CHIP8_HEIGHT][CHIP8_WIDTH];
+    unsigned long long rows[CHIP8_HEIGHT];
+    // Bit y is set when row y changed since the last chip8_screen_fetch_dirty
+    unsigned int dirty;
+    // The same, since the last chip8_screen_fetch_changed; the renderer and
+    // snapshots each consume their own mask
+    unsigned int changed;
 };
 
 void chip8_screen_set(struct chip8_screen* screen, int x, int y);
 void chip8_screen_clear(struct chip8_screen* screen);
 bool chip8_screen_is_set(struct chip8_screen* screen, int x, int y);
 bool chip8_screen_draw_sprite(struct chip8_screen* screen, int x, int y, const char* sprite, int num);
+unsigned int chip8_screen_fetch_dirty(struct chip8_screen* screen);
+unsigned int chip8_screen_fetch_changed(struct chip8_screen* screen);
+unsigned long long chip8_screen_hash(const struct chip8_screen* screen);
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef CHIP8SNAPSHOT_H
+#define CHIP8SNAPSHOT_H
+
+#include "config.h"
+#include "chip8_state.h"
+
+// An in-memory state kept in step with one machine for rollback. Saving
+// copies only the memory blocks and screen rows the machine changed since the
+// last save or restore, restoring writes back only the ones changed since the
+// snapshot. Both go by the machine's memory dirty and screen changed masks, so
+// only one snapshot may track a machine at a time
+struct chip8_snapshot
+{
+    struct chip8_state state;
+
+    // What the last save or restore had to copy
+    int copied_blocks;
+    int copied_rows;
+};
+
+void chip8_snapshot_init(struct chip8_snapshot* snapshot, struct chip8* chip8);
+void chip8_snapshot_save(struct chip8_snapshot* snapshot, struct chip8* chip8);
+void chip8_snapshot_restore(struct chip8_snapshot* snapshot, struct chip8* chip8);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef CHIP8STATE_H
+#define CHIP8STATE_H
+
+#include <stdbool.h>
+#include "config.h"
+#include "chip8.h"
+
+#define CHIP8_STATE_MAGIC "C8ST"
+// Bump whenever the layout of struct chip8_state changes
+#define CHIP8_STATE_VERSION 1
+
+// A save state is this struct written out as is, so a file can be mapped and
+// used in place. Fields are ordered by size so there is no padding between them; the format is
+// host byte order and a file from a different layout is rejected by its size.
+// Host key bindings, the engine and breakpoints are not machine state and are
+// left alone on restore
+struct chip8_state
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int size;
+    unsigned int cycles_per_frame;
+    unsigned int frame_cycles;
+    unsigned int reserved;
+
+    unsigned long long cycles;
+    unsigned long long frames;
+    unsigned long long random;
+    unsigned long long screen[CHIP8_HEIGHT];
+
+    unsigned short stack[CHIP8_TOTAL_STACK_DEPTH];
+    unsigned short I;
+    unsigned short PC;
+    unsigned short keys_down;
+    unsigned short keys_state;
+    unsigned short keys_pressed;
+    unsigned short keys_released;
+    unsigned short frame_pressed;
+    unsigned short frame_released;
+    unsigned short wait_pressed;
+
+    unsigned char V[CHIP8_TOTAL_DATA_REGISTERS];
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned char SP;
+    unsigned char waiting;
+
+    // Last so the header and registers sit in the first page of a mapping
+    struct chip8_image image;
+};
+
+void chip8_state_capture_registers(const struct chip8* chip8, struct chip8_state* state);
+void chip8_state_restore_registers(struct chip8* chip8, const struct chip8_state* state);
+void chip8_state_capture(const struct chip8* chip8, struct chip8_state* state);
+void chip8_state_restore(struct chip8* chip8, const struct chip8_state* state);
+void chip8_state_restore_block(struct chip8* chip8, const struct chip8_state* state, int block);
+void chip8_state_restore_private(struct chip8* chip8, const struct chip8_state* state);
+bool chip8_state_save(const struct chip8* chip8, const char* filename);
+const struct chip8_state* chip8_state_map(const char* filename);
+void chip8_state_unmap(const struct chip8_state* state);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef CHIP8TELEMETRY_H
+#define CHIP8TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "config.h"
+
+// Running totals written by the emulation thread and readable from any
+// thread. There is one writer, so counting is a relaxed load and store and
+// never a locked read-modify-write
+struct chip8_telemetry
+{
+    atomic_ullong instructions;
+    atomic_ullong frames;
+    atomic_ullong draws;
+    // Draws that erased a lit pixel and set VF
+    atomic_ullong collisions;
+    // Frames that ended idling on Fx0A
+    atomic_ullong key_waits;
+    // Delay and sound timer decrements
+    atomic_ullong timer_ticks;
+};
+
+static inline void chip8_telemetry_add(atomic_ullong* counter, unsigned long long n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Samples a telemetry every interval on its own thread and writes each sample
+// as one JSON object per line
+struct chip8_telemetry_reporter
+{
+    const struct chip8_telemetry* telemetry;
+    unsigned int interval_ms;
+    FILE* file;
+    int socket;
+    atomic_bool running;
+    pthread_t thread;
+};
+
+void chip8_telemetry_init(struct chip8_telemetry* telemetry);
+int chip8_telemetry_format(const struct chip8_telemetry* telemetry, double seconds, double instructions_per_second, char* buf, int size);
+bool chip8_telemetry_reporter_start(struct chip8_telemetry_reporter* reporter, const struct chip8_telemetry* telemetry, const char* target, unsigned int interval_ms);
+void chip8_telemetry_reporter_stop(struct chip8_telemetry_reporter* reporter);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef CHIP8THREADED_H
+#define CHIP8THREADED_H
+
+struct chip8;
+
+unsigned int chip8_threaded_exec(struct chip8* chip8, unsigned int cycles);
+
+#endif
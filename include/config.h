@@ -3,6 +3,10 @@
 
 #define EMULATOR_WINDOW_TITLE "Chip8 Emulator"
 #define CHIP8_MEMORY_SIZE 4096
+#define CHIP8_MEMORY_PAGE_SIZE 256
+#define CHIP8_MEMORY_TOTAL_PAGES (CHIP8_MEMORY_SIZE / CHIP8_MEMORY_PAGE_SIZE)
+#define CHIP8_MEMORY_BLOCK_SIZE 64
+#define CHIP8_MEMORY_TOTAL_BLOCKS (CHIP8_MEMORY_SIZE / CHIP8_MEMORY_BLOCK_SIZE)
 #define CHIP8_PROGRAM_LOAD_ADDRESS 0X200
 #define CHIP8_WIDTH 64
 #define CHIP8_HEIGHT 32
@@ -12,8 +16,25 @@
 #define CHIP8_TOTAL_DATA_REGISTERS 16
 #define CHIP8_TOTAL_STACK_DEPTH 16
 #define CHIP8_TOTAL_KEYS 16
+#define CHIP8_KEYBOARD_MAP_BITS 6
+#define CHIP8_KEYBOARD_MAP_SIZE (1 << CHIP8_KEYBOARD_MAP_BITS)
 #define CHIP8_CHARACTER_SET_LOAD_ADDRESS 0x00
 #define CHIP8_DEFAULT_SPRITE_HEIGHT 5
+#define CHIP8_FRAMES_PER_SECOND 60
+#define CHIP8_CYCLES_PER_FRAME 10
+#define CHIP8_PACER_MAX_LAG_FRAMES 4
+#define CHIP8_DEFAULT_RANDOM_SEED 0
+
+#define CHIP8_JIT_CODE_SIZE 0x40000
+#define CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS 32
+#define CHIP8_JIT_MAX_EXITS 0x2000
+#define CHIP8_LOCKSTEP_LANES 32
+
+#define CHIP8_REWIND_KEYFRAME_INTERVAL 60
+#define CHIP8_REWIND_MAX_FRAMES (CHIP8_FRAMES_PER_SECOND * 60)
+#define CHIP8_REWIND_BUFFER_SIZE 0x40000
+// Turbo frames between two looks at the clock for the next rewind record
+#define CHIP8_REWIND_TURBO_CHECK_FRAMES 64
 
 #endif
 
@@ -1,12 +1,16 @@
 #include "chip8.h"
+#include "chip8_threaded.h"
+#include "chip8_movie.h"
+#include "chip8_telemetry.h"
 #include <memory.h>
 #include <assert.h>
-#include <time.h>
-#include "SDL2/SDL.h"
+#include <stdio.h>
 
 //http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
 
-const char chip8_default_character_set[] = {
+// Font at CHIP8_CHARACTER_SET_LOAD_ADDRESS and zeroes everywhere else. Every
+// machine maps this read-only until it writes
+static const struct chip8_image chip8_default_image = {{
     0xF0, 0x90, 0x90, 0x90, 0xF0,
     0x20, 0x60, 0x20, 0x20, 0x70,
     0xF0, 0x10, 0xF0, 0x80, 0xF0,
@@ -23,313 +27,675 @@ const char chip8_default_character_set[] = {
     0xE0, 0x90, 0x90, 0x90, 0xE0,
     0xF0, 0x80, 0xF0, 0x80, 0xF0,
     0xF0, 0x80, 0xF0, 0x80, 0x80
-};
+}};
 
-void chip8_init(struct chip8* chip8)
+// Returns false when the instruction cache cannot be mapped, the machine must
+// not be run then
+bool chip8_init(struct chip8* chip8)
 {
     memset(chip8, 0, sizeof(struct chip8));
-    memcpy(&chip8->memory.memory, chip8_default_character_set, sizeof(chip8_default_character_set));
+    chip8_memory_init(&chip8->memory, chip8_default_image.memory);
+    chip8_random_seed(&chip8->random, CHIP8_DEFAULT_RANDOM_SEED);
+    chip8->cycles_per_frame = CHIP8_CYCLES_PER_FRAME;
+    return chip8_instruction_cache_init(&chip8->instructions);
 }
 
-void chip8_load(struct chip8* chip8, const char* buf, size_t size)
+void chip8_destroy(struct chip8* chip8)
 {
-    assert(size + CHIP8_PROGRAM_LOAD_ADDRESS < CHIP8_MEMORY_SIZE);
-    memcpy(&chip8->memory.memory[CHIP8_PROGRAM_LOAD_ADDRESS], buf, size);
+    chip8_memory_destroy(&chip8->memory);
+    chip8_instruction_cache_destroy(&chip8->instructions);
+    if(chip8->jit)
+    {
+        chip8_jit_destroy(chip8->jit);
+        chip8->jit = 0;
+    }
+}
+
+static void chip8_loaded(struct chip8* chip8)
+{
+    chip8_instruction_cache_clear(&chip8->instructions);
+    if(chip8->jit)
+        chip8_jit_flush(chip8->jit);
+
     chip8->registers.PC = CHIP8_PROGRAM_LOAD_ADDRESS;
 }
 
-static void chip8_exec_extended_eight(struct chip8* chip8, unsigned short opcode){
+// Writes the program into this machine's own pages, returns false when they
+// cannot be allocated
+bool chip8_load(struct chip8* chip8, const char* buf, size_t size)
+{
+    assert(size + CHIP8_PROGRAM_LOAD_ADDRESS < CHIP8_MEMORY_SIZE);
+    size_t i;
+    for(i = 0; i < size; i++)
+    {
+        if(!chip8_memory_set(&chip8->memory, CHIP8_PROGRAM_LOAD_ADDRESS + i, buf[i]))
+            return false;
+    }
+
+    chip8_loaded(chip8);
+    return true;
+}
+
+// Reads at most size bytes, returns false when the file cannot be read or is larger
+static bool chip8_read_file(const char* filename, char* buf, size_t* size)
+{
+    FILE* f = fopen(filename, "rb");
+    if(!f)
+        return false;
+
+    size_t read = fread(buf, 1, *size, f);
+    bool fits = read < *size && !ferror(f);
+    fclose(f);
+    *size = read;
+    return fits;
+}
+
+// Returns false when the file cannot be read, does not fit above the load address
+// or cannot be written into memory
+bool chip8_load_file(struct chip8* chip8, const char* filename)
+{
+    char buf[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_LOAD_ADDRESS];
+    size_t size = sizeof(buf);
+    if(!chip8_read_file(filename, buf, &size))
+        return false;
+
+    return chip8_load(chip8, buf, size);
+}
+
+// Builds the initial memory of a program, font included, for chip8_load_image
+void chip8_image_init(struct chip8_image* image, const char* buf, size_t size)
+{
+    assert(size + CHIP8_PROGRAM_LOAD_ADDRESS < CHIP8_MEMORY_SIZE);
+    memcpy(image->memory, chip8_default_image.memory, CHIP8_MEMORY_SIZE);
+    memcpy(&image->memory[CHIP8_PROGRAM_LOAD_ADDRESS], buf, size);
+}
+
+bool chip8_image_load_file(struct chip8_image* image, const char* filename)
+{
+    char buf[CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_LOAD_ADDRESS];
+    size_t size = sizeof(buf);
+    if(!chip8_read_file(filename, buf, &size))
+        return false;
+
+    chip8_image_init(image, buf, size);
+    return true;
+}
+
+// Maps image read-only in place of the machine's memory. Any number of machines
+// can share one image, each only pays for the pages it writes. The image must
+// outlive them
+void chip8_load_image(struct chip8* chip8, const struct chip8_image* image)
+{
+    chip8_memory_destroy(&chip8->memory);
+    chip8_memory_init(&chip8->memory, image->memory);
+    chip8_loaded(chip8);
+}
+
+// Writes through to memory and drops any decoded or translated code covering index.
+// A write that cannot get its page is dropped and leaves memory.failed set
+void chip8_memory_write(struct chip8* chip8, int index, unsigned char val)
+{
+    if(!chip8_memory_set(&chip8->memory, index, val))
+        return;
+    chip8_instruction_cache_invalidate(&chip8->instructions, index);
+    if(chip8->jit)
+        chip8_jit_invalidate(chip8->jit, index);
+}
+
+static void chip8_op_nop(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+}
+
+static void chip8_op_cls(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8_screen_clear(&chip8->screen);
+}
+
+static void chip8_op_ret(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.PC = chip8_stack_pop(chip8);
+}
+
+static void chip8_op_jp(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.PC = ins->nnn;
+}
 
-    unsigned char x = (opcode >> 8) & 0x000F;
-    unsigned char y = (opcode >> 4) & 0x000F;
-    unsigned char final_four_bits = opcode & 0x000F;
-    unsigned short tmp = 0;
+static void chip8_op_call(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8_stack_push(chip8, chip8->registers.PC);
+    chip8->registers.PC = ins->nnn;
+}
 
-    switch(final_four_bits)
+static void chip8_op_se_byte(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(chip8->registers.V[ins->x] == ins->kk)
     {
-        //8xy0 LD - Vx, Vy, Vx = Vy        
-        case 0x00:
-            chip8->registers.V[x] = chip8->registers.V[y];
-        break;
+        chip8->registers.PC += 2;
+    }
+}
 
-        //8xy1 LD - OR Vx, Vy, Vx OR Vy        
-        case 0x01:
-            chip8->registers.V[x] = chip8->registers.V[x] | chip8->registers.V[y];
-        break;
+static void chip8_op_sne_byte(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(chip8->registers.V[ins->x] != ins->kk)
+    {
+        chip8->registers.PC += 2;
+    }
+}
 
-        //8xy2 LD - AND Vx, Vy, Vx AND Vy
-        case 0x02:
-            chip8->registers.V[x] = chip8->registers.V[x] & chip8->registers.V[y];
-        break;
+static void chip8_op_se_reg(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(chip8->registers.V[ins->x] == chip8->registers.V[ins->y])
+    {
+        chip8->registers.PC += 2;
+    }
+}
 
-        //8xy3 LD - XOR Vx, Vy, Vx XOR Vy
-        case 0x03:
-            chip8->registers.V[x] = chip8->registers.V[x] ^ chip8->registers.V[y];
-        break;
+static void chip8_op_ld_byte(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = ins->kk;
+}
 
-        //8xy4 LD - ADD Vx, Vy
-        case 0x04:
-            tmp = chip8->registers.V[x] + chip8->registers.V[y];
-            chip8->registers.V[0x0f] = (tmp > 0xFF);
-            chip8->registers.V[x] = tmp;
-        break;
+static void chip8_op_add_byte(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] += ins->kk;
+}
 
-        //8xy5 LD - SUB Vx, Vy
-        case 0x05:
-            chip8->registers.V[0x0f] = (chip8->registers.V[x] > chip8->registers.V[y]);
-            chip8->registers.V[x] = chip8->registers.V[x] - chip8->registers.V[y];
-        break;
+static void chip8_op_ld_reg(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->y];
+}
 
-        //8xy6 SHR - Vx {, Vy}
-        case 0x06:
-            chip8->registers.V[0x0f] = chip8->registers.V[x] & 0x01;
-            chip8->registers.V[x] = chip8->registers.V[x] / 2;
-        break;
+static void chip8_op_or(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] | chip8->registers.V[ins->y];
+}
 
-        //8xy7 SUBN - Vx, Vy
-        case 0x07:
-            chip8->registers.V[0x0f] = chip8->registers.V[y] > chip8->registers.V[x];
-            chip8->registers.V[x] = chip8->registers.V[y] - chip8->registers.V[x];
-        break;
+static void chip8_op_and(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] & chip8->registers.V[ins->y];
+}
 
-        //8xyE SHL - Vx, Vy
-        case 0x0E:
-            chip8->registers.V[0x0f] = chip8->registers.V[x] & 0b10000000;
-            chip8->registers.V[x] = chip8->registers.V[x] * 2;
-        break;
+static void chip8_op_xor(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] ^ chip8->registers.V[ins->y];
+}
+
+static void chip8_op_add_reg(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    unsigned short tmp = chip8->registers.V[ins->x] + chip8->registers.V[ins->y];
+    chip8->registers.V[0x0f] = (tmp > 0xFF);
+    chip8->registers.V[ins->x] = tmp;
+}
+
+static void chip8_op_sub(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[0x0f] = (chip8->registers.V[ins->x] > chip8->registers.V[ins->y]);
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] - chip8->registers.V[ins->y];
+}
+
+static void chip8_op_shr(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[0x0f] = chip8->registers.V[ins->x] & 0x01;
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] / 2;
+}
+
+static void chip8_op_subn(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[0x0f] = chip8->registers.V[ins->y] > chip8->registers.V[ins->x];
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->y] - chip8->registers.V[ins->x];
+}
+
+static void chip8_op_shl(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[0x0f] = chip8->registers.V[ins->x] & 0b10000000;
+    chip8->registers.V[ins->x] = chip8->registers.V[ins->x] * 2;
+}
+
+static void chip8_op_sne_reg(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(chip8->registers.V[ins->x] != chip8->registers.V[ins->y])
+    {
+        chip8->registers.PC += 2;
     }
 }
 
-static char chip8_wait_for_key_press(struct chip8* chip8)
+static void chip8_op_ld_i(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.I = ins->nnn;
+}
+
+static void chip8_op_jp_v0(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.PC = ins->nnn + chip8->registers.V[0x00];
+}
+
+static void chip8_op_rnd(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8_random_byte(&chip8->random) & ins->kk;
+}
+
+static void chip8_op_drw(struct chip8* chip8, const struct chip8_instruction* ins)
 {
-    SDL_Event event;
-    while(SDL_WaitEvent(&event)) 
+    // The sprite may straddle two pages
+    char sprite[16];
+    int i;
+    for(i = 0; i < ins->n; i++)
+        sprite[i] = chip8_memory_get(&chip8->memory, chip8->registers.I + i);
+
+    chip8->registers.V[0x0f] = chip8_screen_draw_sprite(&chip8->screen, 
+                                                    chip8->registers.V[ins->x], 
+                                                    chip8->registers.V[ins->y],
+                                                    sprite, 
+                                                    ins->n);
+
+    if(chip8->telemetry)
     {
-        if(event.type != SDL_KEYDOWN)
-            continue;
+        chip8_telemetry_add(&chip8->telemetry->draws, 1);
+        chip8_telemetry_add(&chip8->telemetry->collisions, chip8->registers.V[0x0f]);
+    }
+}
 
-        char c = event.key.keysym.sym;
-        char chip8_key = chip8_keyboard_map(&chip8->keyboard, c);
-        
-        if(chip8_key != -1)
-        {
-            return chip8_key;
-        }
+static void chip8_op_skp(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(chip8_keyboard_is_down(&chip8->keyboard, chip8->registers.V[ins->x]))
+        chip8->registers.PC += 2;
+}
+
+static void chip8_op_sknp(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    if(!chip8_keyboard_is_down(&chip8->keyboard, chip8->registers.V[ins->x]))
+        chip8->registers.PC += 2;
+}
+
+static void chip8_op_ld_vx_dt(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.V[ins->x] = chip8->registers.delay_timer;
+}
+
+static void chip8_op_ld_vx_k(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    int key = chip8_keyboard_wait_key(&chip8->keyboard);
+    if(key != -1)
+    {
+        chip8->registers.V[ins->x] = key;
+        return;
     }
 
-    return -1;
+    // Park on this instruction until a press is latched at a frame boundary
+    chip8->registers.PC -= 2;
+    chip8->key_wait = true;
 }
 
-static void chip8_exec_extended_F(struct chip8* chip8, unsigned short opcode)
+static void chip8_op_ld_dt_vx(struct chip8* chip8, const struct chip8_instruction* ins)
 {
-    unsigned char x = (opcode >> 8) & 0x000F;
+    chip8->registers.delay_timer = chip8->registers.V[ins->x];
+}
+
+static void chip8_op_ld_st_vx(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.sound_timer = chip8->registers.V[ins->x];
+}
+
+static void chip8_op_add_i_vx(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.I += chip8->registers.V[ins->x];
+}
+
+static void chip8_op_ld_f_vx(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    chip8->registers.I = chip8->registers.V[ins->x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
+}
 
-    switch (opcode & 0x00ff)
+static void chip8_op_ld_b_vx(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    unsigned char hundreds = chip8->registers.V[ins->x] / 100;
+    unsigned char tens = chip8->registers.V[ins->x] / 10 % 10;
+    unsigned char units = chip8->registers.V[ins->x] % 10;
+    chip8_memory_write(chip8, chip8->registers.I, hundreds);  //B
+    chip8_memory_write(chip8, chip8->registers.I + 1, tens);  //C
+    chip8_memory_write(chip8, chip8->registers.I + 2, units); //D
+}
+
+static void chip8_op_ld_mem_vx(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    int i;
+    for(i = 0; i <= ins->x; i++){
+        chip8_memory_write(chip8, chip8->registers.I + i, chip8->registers.V[i]);
+    }
+}
+
+static void chip8_op_ld_vx_mem(struct chip8* chip8, const struct chip8_instruction* ins)
+{
+    int i;
+    for(i = 0; i <= ins->x; i++){
+        chip8->registers.V[i] = chip8_memory_get(&chip8->memory, chip8->registers.I + i);
+    }
+}
+
+static const chip8_instruction_handler chip8_handlers[CHIP8_TOTAL_OPS] = {
+    [CHIP8_OP_NOP] = chip8_op_nop,
+    [CHIP8_OP_CLS] = chip8_op_cls,
+    [CHIP8_OP_RET] = chip8_op_ret,
+    [CHIP8_OP_JP] = chip8_op_jp,
+    [CHIP8_OP_CALL] = chip8_op_call,
+    [CHIP8_OP_SE_BYTE] = chip8_op_se_byte,
+    [CHIP8_OP_SNE_BYTE] = chip8_op_sne_byte,
+    [CHIP8_OP_SE_REG] = chip8_op_se_reg,
+    [CHIP8_OP_LD_BYTE] = chip8_op_ld_byte,
+    [CHIP8_OP_ADD_BYTE] = chip8_op_add_byte,
+    [CHIP8_OP_LD_REG] = chip8_op_ld_reg,
+    [CHIP8_OP_OR] = chip8_op_or,
+    [CHIP8_OP_AND] = chip8_op_and,
+    [CHIP8_OP_XOR] = chip8_op_xor,
+    [CHIP8_OP_ADD_REG] = chip8_op_add_reg,
+    [CHIP8_OP_SUB] = chip8_op_sub,
+    [CHIP8_OP_SHR] = chip8_op_shr,
+    [CHIP8_OP_SUBN] = chip8_op_subn,
+    [CHIP8_OP_SHL] = chip8_op_shl,
+    [CHIP8_OP_SNE_REG] = chip8_op_sne_reg,
+    [CHIP8_OP_LD_I] = chip8_op_ld_i,
+    [CHIP8_OP_JP_V0] = chip8_op_jp_v0,
+    [CHIP8_OP_RND] = chip8_op_rnd,
+    [CHIP8_OP_DRW] = chip8_op_drw,
+    [CHIP8_OP_SKP] = chip8_op_skp,
+    [CHIP8_OP_SKNP] = chip8_op_sknp,
+    [CHIP8_OP_LD_VX_DT] = chip8_op_ld_vx_dt,
+    [CHIP8_OP_LD_VX_K] = chip8_op_ld_vx_k,
+    [CHIP8_OP_LD_DT_VX] = chip8_op_ld_dt_vx,
+    [CHIP8_OP_LD_ST_VX] = chip8_op_ld_st_vx,
+    [CHIP8_OP_ADD_I_VX] = chip8_op_add_i_vx,
+    [CHIP8_OP_LD_F_VX] = chip8_op_ld_f_vx,
+    [CHIP8_OP_LD_B_VX] = chip8_op_ld_b_vx,
+    [CHIP8_OP_LD_MEM_VX] = chip8_op_ld_mem_vx,
+    [CHIP8_OP_LD_VX_MEM] = chip8_op_ld_vx_mem,
+};
+
+static enum chip8_op chip8_decode_extended_eight(unsigned short opcode)
+{
+    switch(opcode & 0x000F)
     {
-        //Fx07 - LD Vx, DT. Set Vx = delay timer value.
-        case 0x07:
-            chip8->registers.V[x] = chip8->registers.delay_timer;
-        break;
+        //8xy0 LD - Vx, Vy, Vx = Vy
+        case 0x00: return CHIP8_OP_LD_REG;
+        //8xy1 LD - OR Vx, Vy, Vx OR Vy
+        case 0x01: return CHIP8_OP_OR;
+        //8xy2 LD - AND Vx, Vy, Vx AND Vy
+        case 0x02: return CHIP8_OP_AND;
+        //8xy3 LD - XOR Vx, Vy, Vx XOR Vy
+        case 0x03: return CHIP8_OP_XOR;
+        //8xy4 LD - ADD Vx, Vy
+        case 0x04: return CHIP8_OP_ADD_REG;
+        //8xy5 LD - SUB Vx, Vy
+        case 0x05: return CHIP8_OP_SUB;
+        //8xy6 SHR - Vx {, Vy}
+        case 0x06: return CHIP8_OP_SHR;
+        //8xy7 SUBN - Vx, Vy
+        case 0x07: return CHIP8_OP_SUBN;
+        //8xyE SHL - Vx, Vy
+        case 0x0E: return CHIP8_OP_SHL;
+    }
 
+    return CHIP8_OP_NOP;
+}
+
+static enum chip8_op chip8_decode_extended_F(unsigned short opcode)
+{
+    switch(opcode & 0x00ff)
+    {
+        //Fx07 - LD Vx, DT. Set Vx = delay timer value.
+        case 0x07: return CHIP8_OP_LD_VX_DT;
         //Fx0A - LD Vx, K. Wait for a key press, store the value of the key in Vx.
-        case 0x0A:
-        {
-            char pressed_key = chip8_wait_for_key_press(chip8);
-            chip8->registers.V[x] = pressed_key;
-        }
-        break;
-        
+        case 0x0A: return CHIP8_OP_LD_VX_K;
         //Fx15 - LD DT, Vx. Set delay timer = Vx.
-        case 0x15:
-            chip8->registers.delay_timer = chip8->registers.V[x];
-        break;
-
+        case 0x15: return CHIP8_OP_LD_DT_VX;
         //Fx18 - LD ST, Vx. Set sound timer = Vx.
-        case 0x18:
-            chip8->registers.sound_timer = chip8->registers.V[x];
-        break;
-
+        case 0x18: return CHIP8_OP_LD_ST_VX;
         //Fx1E - ADD I, Vx. Set I = I + Vx.
-        case 0x1E:
-            chip8->registers.I += chip8->registers.V[x];
-        break;
-
+        case 0x1E: return CHIP8_OP_ADD_I_VX;
         //Fx29 - LD F, Vx. Set I = location of sprite for digit Vx.
-        case 0x29:
-            chip8->registers.I = chip8->registers.V[x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
-        break;
-
+        case 0x29: return CHIP8_OP_LD_F_VX;
         //Fx33 - LD B, Vx. Store BCD representation of Vx in memory locations I, I+1, and I+2.
-        case 0x33:
-        {
-            unsigned char hundreds = chip8->registers.V[x] / 100;
-            unsigned char tens = chip8->registers.V[x] / 10 % 10;
-            unsigned char units = chip8->registers.V[x] % 10;
-            chip8_memory_set(&chip8->memory, chip8->registers.I, hundreds);  //B
-            chip8_memory_set(&chip8->memory, chip8->registers.I + 1, tens);  //C
-            chip8_memory_set(&chip8->memory, chip8->registers.I + 2, units); //D
-        }
-        break;
-
+        case 0x33: return CHIP8_OP_LD_B_VX;
         //Fx55 - LD [I], Vx. Store registers V0 through Vx in memory starting at location I.
-        case 0x55:
-        {
-            int i;
-            for(i = 0; i <= x; i++){
-                chip8_memory_set(&chip8->memory, chip8->registers.I + i, chip8->registers.V[i]);
-            }
-        }
-        break;
-
+        case 0x55: return CHIP8_OP_LD_MEM_VX;
         //Fx65 - LD Vx, [I]. Read registers V0 through Vx from memory starting at location I.
-        case 0x65:{
-            int i;
-            for(i = 0; i <= x; i++){
-				chip8->registers.V[i] = chip8_memory_get(&chip8->memory, chip8->registers.I + i);
-			}
-        }
-        break;
+        case 0x65: return CHIP8_OP_LD_VX_MEM;
     }
+
+    return CHIP8_OP_NOP;
 }
 
-static void chip8_exec_extended(struct chip8* chip8, unsigned short opcode)
+static enum chip8_op chip8_decode_extended(unsigned short opcode)
 {
-    unsigned short nnn = opcode & 0x0FFF;
-    unsigned char x = (opcode >> 8) & 0x000F;
-    unsigned char y = (opcode >> 4) & 0x000F;
-    unsigned short kk = opcode & 0x00FF;
-    unsigned char n = opcode & 0x000F;
-
     switch(opcode & 0xF000)
     {
         //1nnn - JP addr: Jump to location nnns
-        case 0x1000:
-            chip8->registers.PC = nnn;
-        break;
-
+        case 0x1000: return CHIP8_OP_JP;
         //2nnn - CALL addr: Call subroutine at location nnn
-        case 0x2000:
-            chip8_stack_push(chip8, chip8->registers.PC);
-            chip8->registers.PC = nnn;
-        break;
-
+        case 0x2000: return CHIP8_OP_CALL;
         //3xkk - SE: Vx, byte - Skip next instruction if Vx = kk
-        case 0x3000:
-            if(chip8->registers.V[x] == kk)
-            {
-                chip8->registers.PC += 2;
-            }
-        break;
-
+        case 0x3000: return CHIP8_OP_SE_BYTE;
         //4xkk - SNE: Vx, byte - Skip next instruction if Vx != kk
-        case 0x4000:
-            if(chip8->registers.V[x] != kk)
-            {
-                chip8->registers.PC += 2;
-            }
-        break;
-
+        case 0x4000: return CHIP8_OP_SNE_BYTE;
         //5xy0 - SE: Vx, Vy - Skip next instruction if Vx = Vy
-        case 0x5000:
-            if(chip8->registers.V[x] == chip8->registers.V[y])
+        case 0x5000: return CHIP8_OP_SE_REG;
+        //6xkk LD - Vx, byte, Vx = kk
+        case 0x6000: return CHIP8_OP_LD_BYTE;
+        //7xkk ADD - Vx, byte, Vx = Vx + kk;
+        case 0x7000: return CHIP8_OP_ADD_BYTE;
+        case 0x8000: return chip8_decode_extended_eight(opcode);
+        // 9xy0 - SNE: Vx, Vy. Skip next instruction if Vx != Vy
+        case 0x9000: return CHIP8_OP_SNE_REG;
+        // Annn - LD: I, addr
+        case 0xA000: return CHIP8_OP_LD_I;
+        // Bnnn - JP: V0, addr
+        case 0xB000: return CHIP8_OP_JP_V0;
+        // Cxkk - RND: Vx, byte. Set Vx = random byte AND kk.
+        case 0xC000: return CHIP8_OP_RND;
+        // Dxyn - DRW: Vx, Vy, nibble Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+        case 0xD000: return CHIP8_OP_DRW;
+
+        // Keyboard operations
+        case 0xE000:
+            switch(opcode & 0x00ff)
             {
-                chip8->registers.PC += 2;
+                //Ex9E - SKP: Vx. Skip next instruction if key with the value of Vx is pressed.
+                case 0x9E: return CHIP8_OP_SKP;
+                //ExA1 - SKNP: Vx. Skip next instruction if key with the value of Vx is not pressed.
+                case 0xA1: return CHIP8_OP_SKNP;
             }
         break;
 
-        //6xkk LD - Vx, byte, Vx = kk        
-        case 0x6000:
-            chip8->registers.V[x] = kk;
-        break;
+        case 0xF000: return chip8_decode_extended_F(opcode);
+    }
 
-        //7xkk ADD - Vx, byte, Vx = Vx + kk;
-        case 0x7000:
-            chip8->registers.V[x] += kk;
-        break;
+    return CHIP8_OP_NOP;
+}
 
-        case 0x8000:
-            chip8_exec_extended_eight(chip8, opcode);
-        break;
+static enum chip8_op chip8_decode_op(unsigned short opcode)
+{
+    switch(opcode)
+    {
+        // CLS: Clear The Display
+        case 0x00E0: return CHIP8_OP_CLS;
+        // RET: Return from subroutine
+        case 0x00EE: return CHIP8_OP_RET;
+    }
 
-        // 9xy0 - SNE: Vx, Vy. Skip next instruction if Vx != Vy
-        case 0x9000:
-            if(chip8->registers.V[x] != chip8->registers.V[y])
-            {
-                chip8->registers.PC += 2;
-            }
-        break;
+    return chip8_decode_extended(opcode);
+}
 
-        // Annn - LD: I, addr
-        case 0xA000:
-            chip8->registers.I = nnn;
-        break;
+void chip8_decode(struct chip8_instruction* instruction, unsigned short opcode)
+{
+    instruction->nnn = opcode & 0x0FFF;
+    instruction->x = (opcode >> 8) & 0x000F;
+    instruction->y = (opcode >> 4) & 0x000F;
+    instruction->kk = opcode & 0x00FF;
+    instruction->n = opcode & 0x000F;
+    instruction->op = chip8_decode_op(opcode);
+    instruction->handler = chip8_handlers[instruction->op];
+}
 
-        // Bnnn - JP: V0, addr
-        case 0xB000:
-            chip8->registers.PC = nnn + chip8->registers.V[0x00];
-        break;
+const struct chip8_instruction* chip8_fetch(struct chip8* chip8, unsigned short address)
+{
+    assert(address < CHIP8_MEMORY_SIZE);
 
-        // Cxkk - RND: Vx, byte. Set Vx = random byte AND kk.
-        case 0xC000:
-            srand(clock());
-            chip8->registers.V[x] = (rand() % 255) & kk;
-        break;
+    struct chip8_instruction* instruction = &chip8->instructions.instructions[address];
+    if(!instruction->handler)
+    {
+        chip8_decode(chip8_instruction_cache_slot(&chip8->instructions, address), chip8_memory_get_short(&chip8->memory, address));
+    }
 
-        // Dxyn - DRW: Vx, Vy, nibble Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-        case 0xD000:
-        {
-            const char* sprite = (const char*)&chip8->memory.memory[chip8->registers.I];
+    return instruction;
+}
 
-            chip8->registers.V[0x0f] = chip8_screen_draw_sprite(&chip8->screen, 
-                                                            chip8->registers.V[x], 
-                                                            chip8->registers.V[y],
-                                                            sprite, 
-                                                            n);
+void chip8_step(struct chip8* chip8)
+{
+    const struct chip8_instruction* instruction = chip8_fetch(chip8, chip8->registers.PC);
+    chip8->registers.PC += 2;
+    instruction->handler(chip8, instruction);
+}
 
+bool chip8_set_engine(struct chip8* chip8, enum chip8_engine engine)
+{
+    if(engine == CHIP8_ENGINE_JIT && !chip8->jit)
+    {
+        chip8->jit = chip8_jit_create();
+        if(!chip8->jit)
+        {
+            chip8->engine = CHIP8_ENGINE_INTERPRETER;
+            return false;
         }
-        break;
+    }
 
-        // Keyboard operations
-        case 0xE000:
+    chip8->engine = engine;
+    return true;
+}
+
+static unsigned int chip8_exec_engine(struct chip8* chip8, unsigned int cycles)
+{
+    if(chip8->engine == CHIP8_ENGINE_THREADED)
+        return chip8_threaded_exec(chip8, cycles);
+
+    if(chip8->engine == CHIP8_ENGINE_JIT)
+        return chip8_jit_exec(chip8, cycles);
+
+    unsigned int executed;
+    for(executed = 0; executed < cycles && !chip8->key_wait; executed++)
+    {
+        chip8_step(chip8);
+    }
+
+    return executed;
+}
+
+static bool chip8_is_breakpoint(struct chip8* chip8, unsigned short address)
+{
+    return address < CHIP8_MEMORY_SIZE && (chip8->breakpoints[address / 8] & (1 << (address % 8)));
+}
+
+void chip8_set_breakpoint(struct chip8* chip8, unsigned short address, bool enabled)
+{
+    assert(address < CHIP8_MEMORY_SIZE);
+
+    if(chip8_is_breakpoint(chip8, address) == enabled)
+        return;
+
+    chip8->breakpoints[address / 8] ^= 1 << (address % 8);
+    chip8->total_breakpoints += enabled ? 1 : -1;
+}
+
+void chip8_set_cycles_per_frame(struct chip8* chip8, unsigned int cycles_per_frame)
+{
+    assert(cycles_per_frame > 0);
+
+    chip8->cycles_per_frame = cycles_per_frame;
+    if(chip8->frame_cycles >= cycles_per_frame)
+        chip8->frame_cycles = 0;
+}
+
+static void chip8_tick_timers(struct chip8* chip8)
+{
+    if(chip8->telemetry)
+        chip8_telemetry_add(&chip8->telemetry->timer_ticks, (chip8->registers.delay_timer > 0) + (chip8->registers.sound_timer > 0));
+
+    if(chip8->registers.delay_timer > 0)
+        chip8->registers.delay_timer--;
+
+    if(chip8->registers.sound_timer > 0)
+        chip8->registers.sound_timer--;
+}
+
+enum chip8_run_result chip8_run(struct chip8* chip8, unsigned int cycles)
+{
+    enum chip8_run_result result = CHIP8_RUN_CYCLES;
+    unsigned int to_frame = chip8->cycles_per_frame - chip8->frame_cycles;
+    if(to_frame <= cycles)
+    {
+        cycles = to_frame;
+        result = CHIP8_RUN_FRAME;
+    }
+
+    // Input is sampled once per frame, before its first instruction
+    if(chip8->frame_cycles == 0 && cycles > 0)
+    {
+        chip8_keyboard_latch(&chip8->keyboard);
+        if(chip8->movie)
+            chip8_movie_record(chip8->movie, chip8);
+    }
+
+    unsigned int executed = 0;
+    if(chip8->total_breakpoints > 0)
+    {
+        // Breakpoints are checked on the reference path only, the instruction we
+        // start on is always executed so a stopped machine can be resumed
+        for(; executed < cycles && !chip8->key_wait; executed++)
         {
-            switch(opcode & 0x00ff)
+            if(executed > 0 && chip8_is_breakpoint(chip8, chip8->registers.PC))
             {
-                //Ex9E - SKP: Vx. Skip next instruction if key with the value of Vx is pressed.        
-                case 0x9E:
-                    if(chip8_keyboard_is_down(&chip8->keyboard, chip8->registers.V[x]))
-                        chip8->registers.PC += 2;
-                break;
-
-                //ExA1 - SKNP: Vx. Skip next instruction if key with the value of Vx is not pressed.
-                case 0xA1:
-                    if(!chip8_keyboard_is_down(&chip8->keyboard, chip8->registers.V[x]))
-                        chip8->registers.PC += 2;
+                result = CHIP8_RUN_BREAKPOINT;
                 break;
             }
-        }
-        break;
 
-        case 0xF000:
-            chip8_exec_extended_F(chip8, opcode);
-        break;
+            chip8_step(chip8);
+        }
+    }
+    else
+    {
+        executed = chip8_exec_engine(chip8, cycles);
     }
-}
 
-void chip8_exec(struct chip8* chip8, unsigned short opcode)
-{
-    switch(opcode)
+    if(chip8->telemetry)
+        chip8_telemetry_add(&chip8->telemetry->instructions, executed);
+
+    if(chip8->key_wait)
     {
-        // CLS: Clear The Display
-        case 0x00E0:
-            chip8_screen_clear(&chip8->screen);
-        break;
+        if(chip8->telemetry)
+            chip8_telemetry_add(&chip8->telemetry->key_waits, 1);
 
-        // RET: Return from subroutine
-        case 0x00EE:
-            chip8->registers.PC = chip8_stack_pop(chip8);
-        break;
+        // The CPU idles on Fx0A for the rest of the budget while the timers keep running
+        chip8->key_wait = false;
+        executed = cycles;
+        result = CHIP8_RUN_KEY_WAIT;
+    }
 
-        default:
-            chip8_exec_extended(chip8, opcode);
+    chip8->cycles += executed;
+    chip8->frame_cycles += executed;
+    if(chip8->frame_cycles == chip8->cycles_per_frame)
+    {
+        chip8->frame_cycles = 0;
+        chip8->frames++;
+        chip8_tick_timers(chip8);
+        if(chip8->telemetry)
+            chip8_telemetry_add(&chip8->telemetry->frames, 1);
     }
+
+    return result;
+}
+
+void chip8_exec(struct chip8* chip8, unsigned short opcode)
+{
+    struct chip8_instruction instruction;
+    chip8_decode(&instruction, opcode);
+    instruction.handler(chip8, &instruction);
 }
\ No newline at end of file
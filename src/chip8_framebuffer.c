@@ -0,0 +1,52 @@
+#include "chip8_framebuffer.h"
+#include <string.h>
+
+// Set in middle while it holds a frame the reader has not taken yet
+#define CHIP8_FRAMEBUFFER_FRESH 4
+#define CHIP8_FRAMEBUFFER_INDEX 3
+
+void chip8_framebuffer_init(struct chip8_framebuffer* framebuffer)
+{
+    memset(framebuffer->buffers, 0, sizeof(framebuffer->buffers));
+    framebuffer->back = 0;
+    atomic_init(&framebuffer->middle, 1);
+    framebuffer->front = 2;
+    framebuffer->pending_dirty = 0;
+}
+
+bool chip8_framebuffer_publish(struct chip8_framebuffer* framebuffer, struct chip8_screen* screen)
+{
+    unsigned int dirty = chip8_screen_fetch_dirty(screen);
+    if(!dirty)
+        return false;
+
+    framebuffer->pending_dirty |= dirty;
+
+    struct chip8_screen* back = &framebuffer->buffers[framebuffer->back];
+    memcpy(back->rows, screen->rows, sizeof(back->rows));
+    back->dirty = framebuffer->pending_dirty;
+
+    unsigned int previous = atomic_exchange_explicit(&framebuffer->middle,
+                                                     framebuffer->back | CHIP8_FRAMEBUFFER_FRESH,
+                                                     memory_order_acq_rel);
+    framebuffer->back = previous & CHIP8_FRAMEBUFFER_INDEX;
+
+    // The reader took the previous frame, so only this frame's rows are still unseen
+    if(!(previous & CHIP8_FRAMEBUFFER_FRESH))
+        framebuffer->pending_dirty = dirty;
+
+    return true;
+}
+
+struct chip8_screen* chip8_framebuffer_acquire(struct chip8_framebuffer* framebuffer)
+{
+    if(atomic_load_explicit(&framebuffer->middle, memory_order_relaxed) & CHIP8_FRAMEBUFFER_FRESH)
+    {
+        unsigned int previous = atomic_exchange_explicit(&framebuffer->middle, framebuffer->front,
+                                                         memory_order_acq_rel);
+        framebuffer->front = previous & CHIP8_FRAMEBUFFER_INDEX;
+    }
+
+    // The newest complete frame, its dirty rows cover everything since the last one read
+    return &framebuffer->buffers[framebuffer->front];
+}
@@ -0,0 +1,75 @@
+#include "chip8_instruction.h"
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+typedef char chip8_instruction_touched_fits[CHIP8_MEMORY_TOTAL_PAGES <= 32 ? 1 : -1];
+
+#define CHIP8_INSTRUCTION_CACHE_SIZE (CHIP8_MEMORY_SIZE * sizeof(struct chip8_instruction))
+
+bool chip8_instruction_cache_init(struct chip8_instruction_cache* cache)
+{
+#ifdef _WIN32
+    cache->instructions = VirtualAlloc(0, CHIP8_INSTRUCTION_CACHE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    cache->instructions = mmap(0, CHIP8_INSTRUCTION_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(cache->instructions == MAP_FAILED)
+        cache->instructions = 0;
+#endif
+
+    cache->touched = 0;
+    return cache->instructions != 0;
+}
+
+void chip8_instruction_cache_destroy(struct chip8_instruction_cache* cache)
+{
+    if(!cache->instructions)
+        return;
+
+#ifdef _WIN32
+    VirtualFree(cache->instructions, 0, MEM_RELEASE);
+#else
+    munmap(cache->instructions, CHIP8_INSTRUCTION_CACHE_SIZE);
+#endif
+    cache->instructions = 0;
+}
+
+// Only pages that were written need zeroing, the rest are still untouched
+void chip8_instruction_cache_clear(struct chip8_instruction_cache* cache)
+{
+    int page;
+    for(page = 0; page < CHIP8_MEMORY_TOTAL_PAGES; page++)
+    {
+        if(cache->touched & (1u << page))
+            memset(&cache->instructions[page * CHIP8_MEMORY_PAGE_SIZE], 0, CHIP8_MEMORY_PAGE_SIZE * sizeof(struct chip8_instruction));
+    }
+
+    cache->touched = 0;
+}
+
+// A slot on an untouched page was never decoded, writing it would only commit the page
+static void chip8_instruction_cache_drop(struct chip8_instruction_cache* cache, int index)
+{
+    if(cache->touched & (1u << (index / CHIP8_MEMORY_PAGE_SIZE)))
+        cache->instructions[index].handler = 0;
+}
+
+void chip8_instruction_cache_invalidate(struct chip8_instruction_cache* cache, int index)
+{
+    // An instruction spans two bytes, so a write also affects the one starting just before it
+    if(index > 0 && index <= CHIP8_MEMORY_SIZE)
+        chip8_instruction_cache_drop(cache, index - 1);
+
+    if(index >= 0 && index < CHIP8_MEMORY_SIZE)
+        chip8_instruction_cache_drop(cache, index);
+}
+
+// The slot to decode address into
+struct chip8_instruction* chip8_instruction_cache_slot(struct chip8_instruction_cache* cache, int address)
+{
+    cache->touched |= 1u << (address / CHIP8_MEMORY_PAGE_SIZE);
+    return &cache->instructions[address];
+}
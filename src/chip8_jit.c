@@ -0,0 +1,592 @@
+#include "chip8_jit.h"
+#include "chip8.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_SUPPORTED
+#endif
+
+#ifdef CHIP8_JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Worst case size of one translated block, checked before every translation
+#define CHIP8_JIT_MAX_BLOCK_BYTES 4096
+
+#define CHIP8_JIT_EAX 0
+#define CHIP8_JIT_ECX 1
+#define CHIP8_JIT_EDX 2
+
+#define CHIP8_JIT_V(x) (int)(offsetof(struct chip8, registers.V) + (x))
+#define CHIP8_JIT_I (int)offsetof(struct chip8, registers.I)
+#define CHIP8_JIT_DT (int)offsetof(struct chip8, registers.delay_timer)
+#define CHIP8_JIT_ST (int)offsetof(struct chip8, registers.sound_timer)
+#define CHIP8_JIT_PC (int)offsetof(struct chip8, registers.PC)
+
+enum chip8_jit_state
+{
+    CHIP8_JIT_UNTRANSLATED,
+    CHIP8_JIT_TRANSLATED,
+    // The instruction at this address must go through the interpreter
+    CHIP8_JIT_INTERPRETED
+};
+
+// An exit stub that returns to the dispatcher until its target is translated
+struct chip8_jit_exit
+{
+    unsigned int site;
+    int next;
+};
+
+struct chip8_jit
+{
+    unsigned char* code;
+    unsigned int used;
+    unsigned int trampoline_size;
+
+    unsigned char state[CHIP8_MEMORY_SIZE];
+    unsigned int entry[CHIP8_MEMORY_SIZE];
+    bool covered[CHIP8_MEMORY_SIZE];
+
+    // Unpatched exits, chained per target address
+    int pending[CHIP8_MEMORY_SIZE];
+    struct chip8_jit_exit exits[CHIP8_JIT_MAX_EXITS];
+    int total_exits;
+};
+
+// Generated code runs as int block(struct chip8* chip8, int budget, void* entry)
+// with the machine in r8 and the remaining instruction budget in r9d
+typedef int (*chip8_jit_trampoline)(struct chip8* chip8, int budget, const void* entry);
+
+static void chip8_jit_emit(struct chip8_jit* jit, unsigned char byte)
+{
+    jit->code[jit->used++] = byte;
+}
+
+static void chip8_jit_emit_16(struct chip8_jit* jit, unsigned short val)
+{
+    chip8_jit_emit(jit, val & 0xFF);
+    chip8_jit_emit(jit, val >> 8);
+}
+
+static void chip8_jit_emit_32(struct chip8_jit* jit, unsigned int val)
+{
+    chip8_jit_emit_16(jit, val & 0xFFFF);
+    chip8_jit_emit_16(jit, val >> 16);
+}
+
+// op reg, [r8 + disp32]; opcode2 < 0 means a one byte opcode
+static void chip8_jit_emit_rm(struct chip8_jit* jit, bool word, unsigned char opcode, int opcode2, int reg, int disp)
+{
+    if(word)
+        chip8_jit_emit(jit, 0x66);
+
+    chip8_jit_emit(jit, 0x41);
+    chip8_jit_emit(jit, opcode);
+    if(opcode2 >= 0)
+        chip8_jit_emit(jit, opcode2);
+
+    chip8_jit_emit(jit, 0x80 | (reg << 3));
+    chip8_jit_emit_32(jit, disp);
+}
+
+static void chip8_jit_load_byte(struct chip8_jit* jit, int reg, int disp)
+{
+    // movzx reg, byte [r8 + disp]
+    chip8_jit_emit_rm(jit, false, 0x0F, 0xB6, reg, disp);
+}
+
+static void chip8_jit_store_byte(struct chip8_jit* jit, int reg, int disp)
+{
+    // mov byte [r8 + disp], reg8
+    chip8_jit_emit_rm(jit, false, 0x88, -1, reg, disp);
+}
+
+static void chip8_jit_store_word_imm(struct chip8_jit* jit, int disp, unsigned short val)
+{
+    // mov word [r8 + disp], imm16
+    chip8_jit_emit_rm(jit, true, 0xC7, -1, 0, disp);
+    chip8_jit_emit_16(jit, val);
+}
+
+static void chip8_jit_patch(struct chip8_jit* jit, unsigned int site, unsigned int target)
+{
+    // jmp rel32 over the start of the exit stub
+    int rel = (int)target - (int)(site + 5);
+    jit->code[site] = 0xE9;
+    memcpy(&jit->code[site + 1], &rel, sizeof(rel));
+}
+
+// Leaves the block with PC = target, chaining straight into the target once it is translated
+static void chip8_jit_emit_exit(struct chip8_jit* jit, unsigned short target)
+{
+    unsigned int site = jit->used;
+    chip8_jit_store_word_imm(jit, CHIP8_JIT_PC, target);
+    // mov eax, r9d; ret
+    chip8_jit_emit(jit, 0x44);
+    chip8_jit_emit(jit, 0x89);
+    chip8_jit_emit(jit, 0xC8);
+    chip8_jit_emit(jit, 0xC3);
+
+    if(target >= CHIP8_MEMORY_SIZE)
+        return;
+
+    if(jit->state[target] == CHIP8_JIT_TRANSLATED)
+    {
+        chip8_jit_patch(jit, site, jit->entry[target]);
+    }
+    else if(jit->total_exits < CHIP8_JIT_MAX_EXITS)
+    {
+        struct chip8_jit_exit* exit = &jit->exits[jit->total_exits];
+        exit->site = site;
+        exit->next = jit->pending[target];
+        jit->pending[target] = jit->total_exits++;
+    }
+}
+
+// Size of chip8_jit_emit_exit, used to jump over the first of two exits
+#define CHIP8_JIT_EXIT_SIZE 14
+
+static void chip8_jit_emit_trampoline(struct chip8_jit* jit)
+{
+#ifdef _WIN32
+    // mov rax, r8; mov r8, rcx; mov r9d, edx; jmp rax
+    static const unsigned char trampoline[] = { 0x4C, 0x89, 0xC0, 0x49, 0x89, 0xC8, 0x41, 0x89, 0xD1, 0xFF, 0xE0 };
+#else
+    // mov r8, rdi; mov r9d, esi; jmp rdx
+    static const unsigned char trampoline[] = { 0x49, 0x89, 0xF8, 0x41, 0x89, 0xF1, 0xFF, 0xE2 };
+#endif
+    memcpy(jit->code, trampoline, sizeof(trampoline));
+    jit->trampoline_size = sizeof(trampoline);
+}
+
+static bool chip8_jit_is_terminator(unsigned char op)
+{
+    switch(op)
+    {
+        case CHIP8_OP_JP:
+        case CHIP8_OP_SE_BYTE:
+        case CHIP8_OP_SNE_BYTE:
+        case CHIP8_OP_SE_REG:
+        case CHIP8_OP_SNE_REG:
+            return true;
+    }
+
+    return false;
+}
+
+static bool chip8_jit_is_translatable(unsigned char op)
+{
+    switch(op)
+    {
+        case CHIP8_OP_NOP:
+        case CHIP8_OP_LD_BYTE:
+        case CHIP8_OP_ADD_BYTE:
+        case CHIP8_OP_LD_REG:
+        case CHIP8_OP_OR:
+        case CHIP8_OP_AND:
+        case CHIP8_OP_XOR:
+        case CHIP8_OP_ADD_REG:
+        case CHIP8_OP_SUB:
+        case CHIP8_OP_SHR:
+        case CHIP8_OP_SUBN:
+        case CHIP8_OP_SHL:
+        case CHIP8_OP_LD_I:
+        case CHIP8_OP_ADD_I_VX:
+        case CHIP8_OP_LD_F_VX:
+        case CHIP8_OP_LD_VX_DT:
+        case CHIP8_OP_LD_DT_VX:
+        case CHIP8_OP_LD_ST_VX:
+            return true;
+    }
+
+    return chip8_jit_is_terminator(op);
+}
+
+static void chip8_jit_emit_instruction(struct chip8_jit* jit, const struct chip8_instruction* ins)
+{
+    switch(ins->op)
+    {
+        case CHIP8_OP_LD_BYTE:
+            // mov byte [Vx], kk
+            chip8_jit_emit_rm(jit, false, 0xC6, -1, 0, CHIP8_JIT_V(ins->x));
+            chip8_jit_emit(jit, ins->kk);
+        break;
+
+        case CHIP8_OP_ADD_BYTE:
+            // add byte [Vx], kk
+            chip8_jit_emit_rm(jit, false, 0x80, -1, 0, CHIP8_JIT_V(ins->x));
+            chip8_jit_emit(jit, ins->kk);
+        break;
+
+        case CHIP8_OP_LD_REG:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->y));
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        case CHIP8_OP_OR:
+        case CHIP8_OP_AND:
+        case CHIP8_OP_XOR:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->y));
+            // or/and/xor byte [Vx], al
+            chip8_jit_emit_rm(jit, false, ins->op == CHIP8_OP_OR ? 0x08 : ins->op == CHIP8_OP_AND ? 0x20 : 0x30,
+                              -1, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        case CHIP8_OP_ADD_REG:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EDX, CHIP8_JIT_V(ins->y));
+            // add eax, edx; mov edx, eax; shr edx, 8
+            chip8_jit_emit(jit, 0x01);
+            chip8_jit_emit(jit, 0xD0);
+            chip8_jit_emit(jit, 0x89);
+            chip8_jit_emit(jit, 0xC2);
+            chip8_jit_emit(jit, 0xC1);
+            chip8_jit_emit(jit, 0xEA);
+            chip8_jit_emit(jit, 0x08);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EDX, CHIP8_JIT_V(0x0f));
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        // The flag is written before the result is computed, exactly like the interpreter,
+        // so the operands are reloaded in case x or y is VF
+        case CHIP8_OP_SUB:
+        case CHIP8_OP_SUBN:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EDX, CHIP8_JIT_V(ins->y));
+            // cmp eax, edx (SUB) or cmp edx, eax (SUBN); seta cl
+            chip8_jit_emit(jit, 0x39);
+            chip8_jit_emit(jit, ins->op == CHIP8_OP_SUB ? 0xD0 : 0xC2);
+            chip8_jit_emit(jit, 0x0F);
+            chip8_jit_emit(jit, 0x97);
+            chip8_jit_emit(jit, 0xC1);
+            chip8_jit_store_byte(jit, CHIP8_JIT_ECX, CHIP8_JIT_V(0x0f));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EDX, CHIP8_JIT_V(ins->y));
+            if(ins->op == CHIP8_OP_SUB)
+            {
+                // sub eax, edx
+                chip8_jit_emit(jit, 0x29);
+                chip8_jit_emit(jit, 0xD0);
+                chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            }
+            else
+            {
+                // sub edx, eax
+                chip8_jit_emit(jit, 0x29);
+                chip8_jit_emit(jit, 0xC2);
+                chip8_jit_store_byte(jit, CHIP8_JIT_EDX, CHIP8_JIT_V(ins->x));
+            }
+        break;
+
+        case CHIP8_OP_SHR:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // and eax, 1
+            chip8_jit_emit(jit, 0x83);
+            chip8_jit_emit(jit, 0xE0);
+            chip8_jit_emit(jit, 0x01);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(0x0f));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // shr eax, 1
+            chip8_jit_emit(jit, 0xD1);
+            chip8_jit_emit(jit, 0xE8);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        case CHIP8_OP_SHL:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // and eax, 0x80
+            chip8_jit_emit(jit, 0x25);
+            chip8_jit_emit_32(jit, 0x80);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(0x0f));
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // add eax, eax
+            chip8_jit_emit(jit, 0x01);
+            chip8_jit_emit(jit, 0xC0);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        case CHIP8_OP_LD_I:
+            chip8_jit_store_word_imm(jit, CHIP8_JIT_I, ins->nnn);
+        break;
+
+        case CHIP8_OP_ADD_I_VX:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // add word [I], ax
+            chip8_jit_emit_rm(jit, true, 0x01, -1, CHIP8_JIT_EAX, CHIP8_JIT_I);
+        break;
+
+        case CHIP8_OP_LD_F_VX:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // imul eax, eax, CHIP8_DEFAULT_SPRITE_HEIGHT; mov word [I], ax
+            chip8_jit_emit(jit, 0x6B);
+            chip8_jit_emit(jit, 0xC0);
+            chip8_jit_emit(jit, CHIP8_DEFAULT_SPRITE_HEIGHT);
+            chip8_jit_emit_rm(jit, true, 0x89, -1, CHIP8_JIT_EAX, CHIP8_JIT_I);
+        break;
+
+        case CHIP8_OP_LD_VX_DT:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_DT);
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+        break;
+
+        case CHIP8_OP_LD_DT_VX:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_DT);
+        break;
+
+        case CHIP8_OP_LD_ST_VX:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            chip8_jit_store_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_ST);
+        break;
+    }
+}
+
+static void chip8_jit_emit_terminator(struct chip8_jit* jit, const struct chip8_instruction* ins, unsigned short next)
+{
+    unsigned char skip_jcc;
+
+    switch(ins->op)
+    {
+        case CHIP8_OP_JP:
+            chip8_jit_emit_exit(jit, ins->nnn);
+            return;
+
+        case CHIP8_OP_SE_BYTE:
+        case CHIP8_OP_SNE_BYTE:
+            // cmp byte [Vx], kk
+            chip8_jit_emit_rm(jit, false, 0x80, -1, 7, CHIP8_JIT_V(ins->x));
+            chip8_jit_emit(jit, ins->kk);
+            skip_jcc = ins->op == CHIP8_OP_SE_BYTE ? 0x74 : 0x75;
+        break;
+
+        default:
+            chip8_jit_load_byte(jit, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->x));
+            // cmp al, byte [Vy]
+            chip8_jit_emit_rm(jit, false, 0x3A, -1, CHIP8_JIT_EAX, CHIP8_JIT_V(ins->y));
+            skip_jcc = ins->op == CHIP8_OP_SE_REG ? 0x74 : 0x75;
+        break;
+    }
+
+    // je/jne over the not-taken exit to the skipping one
+    chip8_jit_emit(jit, skip_jcc);
+    chip8_jit_emit(jit, CHIP8_JIT_EXIT_SIZE);
+    chip8_jit_emit_exit(jit, next);
+    chip8_jit_emit_exit(jit, next + 2);
+}
+
+static void chip8_jit_translate(struct chip8_jit* jit, struct chip8* chip8, unsigned short start)
+{
+    const struct chip8_instruction* block[CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS];
+    int length = 0;
+    unsigned short address = start;
+
+    while(length < CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS && address + 1 < CHIP8_MEMORY_SIZE)
+    {
+        const struct chip8_instruction* ins = chip8_fetch(chip8, address);
+        if(!chip8_jit_is_translatable(ins->op))
+            break;
+
+        block[length++] = ins;
+        address += 2;
+
+        if(chip8_jit_is_terminator(ins->op))
+            break;
+    }
+
+    if(length == 0)
+    {
+        jit->state[start] = CHIP8_JIT_INTERPRETED;
+        return;
+    }
+
+    if(jit->used + CHIP8_JIT_MAX_BLOCK_BYTES > CHIP8_JIT_CODE_SIZE)
+        chip8_jit_flush(jit);
+
+    unsigned int entry = jit->used;
+
+    // cmp r9d, length; jae body
+    chip8_jit_emit(jit, 0x41);
+    chip8_jit_emit(jit, 0x81);
+    chip8_jit_emit(jit, 0xF9);
+    chip8_jit_emit_32(jit, length);
+    chip8_jit_emit(jit, 0x73);
+    chip8_jit_emit(jit, CHIP8_JIT_EXIT_SIZE);
+
+    // Not enough budget left for the whole block, hand it back to the dispatcher
+    chip8_jit_store_word_imm(jit, CHIP8_JIT_PC, start);
+    chip8_jit_emit(jit, 0x44);
+    chip8_jit_emit(jit, 0x89);
+    chip8_jit_emit(jit, 0xC8);
+    chip8_jit_emit(jit, 0xC3);
+
+    // sub r9d, length
+    chip8_jit_emit(jit, 0x41);
+    chip8_jit_emit(jit, 0x81);
+    chip8_jit_emit(jit, 0xE9);
+    chip8_jit_emit_32(jit, length);
+
+    int i;
+    for(i = 0; i < length; i++)
+    {
+        if(!chip8_jit_is_terminator(block[i]->op))
+            chip8_jit_emit_instruction(jit, block[i]);
+    }
+
+    if(chip8_jit_is_terminator(block[length - 1]->op))
+        chip8_jit_emit_terminator(jit, block[length - 1], address);
+    else
+        chip8_jit_emit_exit(jit, address);
+
+    for(i = start; i < address; i++)
+    {
+        jit->covered[i] = true;
+    }
+
+    jit->entry[start] = entry;
+    jit->state[start] = CHIP8_JIT_TRANSLATED;
+
+    // Chain every block that was waiting for this one
+    int exit;
+    for(exit = jit->pending[start]; exit >= 0; exit = jit->exits[exit].next)
+    {
+        chip8_jit_patch(jit, jit->exits[exit].site, entry);
+    }
+    jit->pending[start] = -1;
+}
+
+struct chip8_jit* chip8_jit_create(void)
+{
+    struct chip8_jit* jit = malloc(sizeof(struct chip8_jit));
+    if(!jit)
+        return 0;
+
+#ifdef _WIN32
+    jit->code = VirtualAlloc(0, CHIP8_JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    jit->code = mmap(0, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->code == MAP_FAILED)
+        jit->code = 0;
+#endif
+
+    if(!jit->code)
+    {
+        free(jit);
+        return 0;
+    }
+
+    chip8_jit_emit_trampoline(jit);
+    chip8_jit_flush(jit);
+    return jit;
+}
+
+void chip8_jit_destroy(struct chip8_jit* jit)
+{
+#ifdef _WIN32
+    VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+    munmap(jit->code, CHIP8_JIT_CODE_SIZE);
+#endif
+    free(jit);
+}
+
+void chip8_jit_flush(struct chip8_jit* jit)
+{
+    jit->used = jit->trampoline_size;
+    jit->total_exits = 0;
+    memset(jit->state, CHIP8_JIT_UNTRANSLATED, sizeof(jit->state));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    memset(jit->pending, 0xFF, sizeof(jit->pending));
+}
+
+void chip8_jit_invalidate(struct chip8_jit* jit, int index)
+{
+    if(index < 0 || index >= CHIP8_MEMORY_SIZE)
+        return;
+
+    // Self-modifying code is rare, so any write into translated code drops the whole cache
+    if(jit->covered[index])
+    {
+        chip8_jit_flush(jit);
+        return;
+    }
+
+    // The rewritten instruction may have become translatable
+    if(index > 0 && jit->state[index - 1] == CHIP8_JIT_INTERPRETED)
+        jit->state[index - 1] = CHIP8_JIT_UNTRANSLATED;
+
+    if(jit->state[index] == CHIP8_JIT_INTERPRETED)
+        jit->state[index] = CHIP8_JIT_UNTRANSLATED;
+}
+
+unsigned int chip8_jit_exec(struct chip8* chip8, unsigned int cycles)
+{
+    struct chip8_jit* jit = chip8->jit;
+    chip8_jit_trampoline enter = (chip8_jit_trampoline)(void*)jit->code;
+    unsigned int executed = 0;
+
+    while(executed < cycles)
+    {
+        unsigned short pc = chip8->registers.PC;
+        if(pc < CHIP8_MEMORY_SIZE && jit->state[pc] == CHIP8_JIT_UNTRANSLATED)
+            chip8_jit_translate(jit, chip8, pc);
+
+        if(pc < CHIP8_MEMORY_SIZE && jit->state[pc] == CHIP8_JIT_TRANSLATED)
+        {
+            int budget = cycles - executed;
+            int remaining = enter(chip8, budget, &jit->code[jit->entry[pc]]);
+            if(remaining != budget)
+            {
+                executed += budget - remaining;
+                continue;
+            }
+        }
+
+        // Untranslatable instruction, or too little budget left for the next block
+        chip8_step(chip8);
+        executed++;
+
+        if(chip8->key_wait)
+            break;
+    }
+
+    return executed;
+}
+
+#else
+
+struct chip8_jit* chip8_jit_create(void)
+{
+    return 0;
+}
+
+void chip8_jit_destroy(struct chip8_jit* jit)
+{
+}
+
+void chip8_jit_flush(struct chip8_jit* jit)
+{
+}
+
+void chip8_jit_invalidate(struct chip8_jit* jit, int index)
+{
+}
+
+unsigned int chip8_jit_exec(struct chip8* chip8, unsigned int cycles)
+{
+    unsigned int executed;
+    for(executed = 0; executed < cycles && !chip8->key_wait; executed++)
+    {
+        chip8_step(chip8);
+    }
+
+    return executed;
+}
+
+#endif
@@ -1,41 +1,174 @@
 #include "chip8_keyboard.h"
 #include <assert.h>
+#include <string.h>
 
 static void chip8_keyboard_ensure_in_bounds(int key){
     assert(key >= 0 && key < CHIP8_TOTAL_KEYS);
 }
 
-void chip8_keyboard_set_map(struct chip8_keyboard* keyboard, const char* map)
+// Bit offsets of the masks packed into keyboard->keys
+#define CHIP8_KEYBOARD_DOWN_SHIFT 0
+#define CHIP8_KEYBOARD_PRESSED_SHIFT 16
+#define CHIP8_KEYBOARD_RELEASED_SHIFT 32
+#define CHIP8_KEYBOARD_MASK 0xffffull
+
+static unsigned short chip8_keyboard_field(unsigned long long keys, int shift)
+{
+    return (keys >> shift) & CHIP8_KEYBOARD_MASK;
+}
+
+// Clears then sets bits of keyboard->keys in one step, against a latch
+// that may be taking the edges away at the same time
+static void chip8_keyboard_update(struct chip8_keyboard* keyboard, unsigned long long clear, unsigned long long set)
+{
+    unsigned long long keys = atomic_load(&keyboard->keys);
+    while(!atomic_compare_exchange_weak(&keyboard->keys, &keys, (keys & ~clear) | set))
+        ;
+}
+
+static unsigned int chip8_keyboard_hash(int code)
 {
-    keyboard->keyboard_map = map;
+    return ((unsigned int)code * 2654435769u) >> (32 - CHIP8_KEYBOARD_MAP_BITS);
 }
 
-int chip8_keyboard_map(struct chip8_keyboard* keyboard, char key)
+// Returns the slot holding code, or the empty slot where it would go
+static struct chip8_keyboard_binding* chip8_keyboard_slot(struct chip8_keyboard* keyboard, int code)
 {
-    
+    unsigned int index = chip8_keyboard_hash(code);
+    while(keyboard->bindings[index].bound && keyboard->bindings[index].code != code)
+        index = (index + 1) & (CHIP8_KEYBOARD_MAP_SIZE - 1);
+
+    return &keyboard->bindings[index];
+}
+
+void chip8_keyboard_set_map(struct chip8_keyboard* keyboard, const int* map)
+{
+    memset(keyboard->bindings, 0, sizeof(keyboard->bindings));
+    keyboard->total_bindings = 0;
+
     int i;
     for(i = 0; i < CHIP8_TOTAL_KEYS; i++)
+        chip8_keyboard_bind(keyboard, map[i], i);
+}
+
+bool chip8_keyboard_bind(struct chip8_keyboard* keyboard, int code, int key)
+{
+    chip8_keyboard_ensure_in_bounds(key);
+
+    struct chip8_keyboard_binding* binding = chip8_keyboard_slot(keyboard, code);
+    if(!binding->bound)
     {
-        if(keyboard->keyboard_map[i] == key)
-        {
-            return i;
-        }
+        // Keep at least a quarter of the table empty so probes stay short
+        if(keyboard->total_bindings >= CHIP8_KEYBOARD_MAP_SIZE * 3 / 4)
+            return false;
+
+        binding->code = code;
+        binding->bound = true;
+        keyboard->total_bindings++;
     }
 
-    return -1;
+    binding->key = key;
+    return true;
+}
+
+int chip8_keyboard_map(struct chip8_keyboard* keyboard, int code)
+{
+    struct chip8_keyboard_binding* binding = chip8_keyboard_slot(keyboard, code);
+    return binding->bound ? binding->key : -1;
 }
 
 void chip8_keyboard_down(struct chip8_keyboard* keyboard, int key)
 {
-    keyboard->keyboard[key] = true;
+    chip8_keyboard_ensure_in_bounds(key);
+    unsigned long long bit = 1ull << key;
+    chip8_keyboard_update(keyboard, 0, bit << CHIP8_KEYBOARD_DOWN_SHIFT | bit << CHIP8_KEYBOARD_PRESSED_SHIFT);
 }
 
 void chip8_keyboard_up(struct chip8_keyboard* keyboard, int key)
 {
-    keyboard->keyboard[key] = false;
+    chip8_keyboard_ensure_in_bounds(key);
+    unsigned long long bit = 1ull << key;
+    chip8_keyboard_update(keyboard, bit << CHIP8_KEYBOARD_DOWN_SHIFT, bit << CHIP8_KEYBOARD_RELEASED_SHIFT);
 }
 
 bool chip8_keyboard_is_down(struct chip8_keyboard* keyboard, int key)
 {
-    return keyboard->keyboard[key];
-}
\ No newline at end of file
+    chip8_keyboard_ensure_in_bounds(key);
+    return (keyboard->state >> key) & 1;
+}
+
+void chip8_keyboard_latch(struct chip8_keyboard* keyboard)
+{
+    // Takes the edges and keeps down, so a press and release that race the
+    // latch land wholly in this frame or wholly in the next
+    unsigned long long keys = atomic_fetch_and(&keyboard->keys, CHIP8_KEYBOARD_MASK << CHIP8_KEYBOARD_DOWN_SHIFT);
+    keyboard->frame_pressed = chip8_keyboard_field(keys, CHIP8_KEYBOARD_PRESSED_SHIFT);
+    keyboard->frame_released = chip8_keyboard_field(keys, CHIP8_KEYBOARD_RELEASED_SHIFT);
+    keyboard->frame_down = chip8_keyboard_field(keys, CHIP8_KEYBOARD_DOWN_SHIFT);
+    keyboard->state = keyboard->frame_down | keyboard->frame_pressed;
+    keyboard->wait_pressed |= keyboard->frame_pressed;
+}
+
+// Returns the first key pressed since the wait began, or -1 while still waiting
+int chip8_keyboard_wait_key(struct chip8_keyboard* keyboard)
+{
+    if(!atomic_load(&keyboard->waiting))
+    {
+        keyboard->wait_pressed = 0;
+        atomic_store(&keyboard->waiting, true);
+        return -1;
+    }
+
+    int key;
+    for(key = 0; key < CHIP8_TOTAL_KEYS; key++)
+    {
+        if(keyboard->wait_pressed & (1 << key))
+        {
+            atomic_store(&keyboard->waiting, false);
+            return key;
+        }
+    }
+
+    return -1;
+}
+
+// Host side: true while Fx0A is waiting and no press is on its way to the core
+bool chip8_keyboard_is_waiting(struct chip8_keyboard* keyboard)
+{
+    return atomic_load(&keyboard->waiting) && !chip8_keyboard_field(atomic_load(&keyboard->keys), CHIP8_KEYBOARD_PRESSED_SHIFT);
+}
+
+// Posts a press or release for every key whose down bit disagrees with held,
+// the keys the host really holds; used after a restore brought back old masks
+void chip8_keyboard_sync(struct chip8_keyboard* keyboard, unsigned short held)
+{
+    unsigned short stale = chip8_keyboard_field(atomic_load(&keyboard->keys), CHIP8_KEYBOARD_DOWN_SHIFT) ^ held;
+
+    int key;
+    for(key = 0; key < CHIP8_TOTAL_KEYS; key++)
+    {
+        if(!(stale & (1 << key)))
+            continue;
+
+        if(held & (1 << key))
+            chip8_keyboard_down(keyboard, key);
+        else
+            chip8_keyboard_up(keyboard, key);
+    }
+}
+
+void chip8_keyboard_load_host(const struct chip8_keyboard* keyboard, unsigned short* down, unsigned short* pressed, unsigned short* released)
+{
+    unsigned long long keys = atomic_load(&keyboard->keys);
+    *down = chip8_keyboard_field(keys, CHIP8_KEYBOARD_DOWN_SHIFT);
+    *pressed = chip8_keyboard_field(keys, CHIP8_KEYBOARD_PRESSED_SHIFT);
+    *released = chip8_keyboard_field(keys, CHIP8_KEYBOARD_RELEASED_SHIFT);
+}
+
+void chip8_keyboard_store_host(struct chip8_keyboard* keyboard, unsigned short down, unsigned short pressed, unsigned short released)
+{
+    atomic_store(&keyboard->keys,
+        (unsigned long long)down << CHIP8_KEYBOARD_DOWN_SHIFT |
+        (unsigned long long)pressed << CHIP8_KEYBOARD_PRESSED_SHIFT |
+        (unsigned long long)released << CHIP8_KEYBOARD_RELEASED_SHIFT);
+}
@@ -0,0 +1,636 @@
+#include "chip8_lockstep.h"
+#include <memory.h>
+#include <assert.h>
+
+// Lane masks are 32 bit wide
+typedef char chip8_lockstep_lanes_fit[CHIP8_LOCKSTEP_LANES <= 32 ? 1 : -1];
+
+#define CHIP8_LOCKSTEP_ALL_LANES ((unsigned int)(((unsigned long long)1 << CHIP8_LOCKSTEP_LANES) - 1))
+
+static int chip8_lockstep_first_lane(unsigned int mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    int lane = 0;
+    while(!(mask & 1))
+    {
+        mask >>= 1;
+        lane++;
+    }
+    return lane;
+#endif
+}
+
+static int chip8_lockstep_count(unsigned int mask)
+{
+#ifdef __GNUC__
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for(; mask; mask &= mask - 1)
+        count++;
+    return count;
+#endif
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && CHIP8_LOCKSTEP_LANES == 32
+#define CHIP8_LOCKSTEP_AVX2
+#include <immintrin.h>
+
+// Built for AVX2 regardless of the compiler flags, only called once
+// __builtin_cpu_supports has confirmed the host has it
+#define CHIP8_AVX2 __attribute__((target("avx2")))
+
+// Spreads bit n of mask to all eight bits of byte n
+CHIP8_AVX2 static inline __m256i chip8_lockstep_byte_mask(unsigned int mask)
+{
+    const __m256i spread = _mm256_setr_epi64x(0x0000000000000000LL, 0x0101010101010101LL,
+                                              0x0202020202020202LL, 0x0303030303030303LL);
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+    __m256i bits = _mm256_shuffle_epi8(_mm256_set1_epi32(mask), spread);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bits, select), select);
+}
+
+CHIP8_AVX2 static inline __m256i chip8_lockstep_load(const void* address)
+{
+    return _mm256_loadu_si256((const __m256i*)address);
+}
+
+CHIP8_AVX2 static inline void chip8_lockstep_store(void* address, __m256i value)
+{
+    _mm256_storeu_si256((__m256i*)address, value);
+}
+
+// Writes value into the masked lanes of a byte array
+CHIP8_AVX2 static inline void chip8_lockstep_store_masked(unsigned char* array, __m256i value, __m256i mask)
+{
+    chip8_lockstep_store(array, _mm256_blendv_epi8(chip8_lockstep_load(array), value, mask));
+}
+
+CHIP8_AVX2 static unsigned int chip8_lockstep_match_avx2(const struct chip8_lockstep* lockstep, int leader, unsigned short pc)
+{
+    __m256i target = _mm256_set1_epi16(pc);
+    __m256i low = _mm256_cmpeq_epi16(chip8_lockstep_load(&lockstep->PC[0]), target);
+    __m256i high = _mm256_cmpeq_epi16(chip8_lockstep_load(&lockstep->PC[16]), target);
+
+    // packs interleaves the two halves per 128 bit lane, the permute restores lane order
+    __m256i same = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+    same = _mm256_and_si256(same, _mm256_cmpeq_epi8(chip8_lockstep_load(lockstep->memory[pc]),
+                                                    _mm256_set1_epi8(lockstep->memory[pc][leader])));
+    same = _mm256_and_si256(same, _mm256_cmpeq_epi8(chip8_lockstep_load(lockstep->memory[pc + 1]),
+                                                    _mm256_set1_epi8(lockstep->memory[pc + 1][leader])));
+    return (unsigned int)_mm256_movemask_epi8(same);
+}
+
+// Adds the masked words of add to a 16 bit lane array
+CHIP8_AVX2 static inline void chip8_lockstep_add_words(unsigned short* array, __m256i add, __m256i mask)
+{
+    __m256i add_low = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(add)),
+                                       _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask)));
+    __m256i add_high = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(add, 1)),
+                                        _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1)));
+    chip8_lockstep_store(&array[0], _mm256_add_epi16(chip8_lockstep_load(&array[0]), add_low));
+    chip8_lockstep_store(&array[16], _mm256_add_epi16(chip8_lockstep_load(&array[16]), add_high));
+}
+
+// Same as chip8_lockstep_add_words with the bytes of add zero extended
+CHIP8_AVX2 static inline void chip8_lockstep_add_bytes_to_words(unsigned short* array, __m256i add, __m256i mask)
+{
+    add = _mm256_and_si256(add, mask);
+    __m256i add_low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(add));
+    __m256i add_high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(add, 1));
+    chip8_lockstep_store(&array[0], _mm256_add_epi16(chip8_lockstep_load(&array[0]), add_low));
+    chip8_lockstep_store(&array[16], _mm256_add_epi16(chip8_lockstep_load(&array[16]), add_high));
+}
+
+CHIP8_AVX2 static inline void chip8_lockstep_set_words(unsigned short* array, unsigned short value, __m256i mask)
+{
+    __m256i mask_low = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask));
+    __m256i mask_high = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1));
+    __m256i set = _mm256_set1_epi16(value);
+    chip8_lockstep_store(&array[0], _mm256_blendv_epi8(chip8_lockstep_load(&array[0]), set, mask_low));
+    chip8_lockstep_store(&array[16], _mm256_blendv_epi8(chip8_lockstep_load(&array[16]), set, mask_high));
+}
+
+// True when every lane in group holds the same I, so memory rows at I are
+// shared addresses across the group
+CHIP8_AVX2 static bool chip8_lockstep_same_i(const struct chip8_lockstep* lockstep, unsigned int group, unsigned short i)
+{
+    __m256i target = _mm256_set1_epi16(i);
+    __m256i low = _mm256_cmpeq_epi16(chip8_lockstep_load(&lockstep->I[0]), target);
+    __m256i high = _mm256_cmpeq_epi16(chip8_lockstep_load(&lockstep->I[16]), target);
+    unsigned int same = (unsigned int)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8));
+    return (same & group) == group;
+}
+
+// Byte n is 0xFF where key x[n] is held on lane n, keys above 15 read as released
+CHIP8_AVX2 static inline __m256i chip8_lockstep_keys_down(const struct chip8_lockstep* lockstep, __m256i x)
+{
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i low_byte = _mm256_set1_epi16(0xff);
+    __m256i keys_low = chip8_lockstep_load(&lockstep->keys[0]);
+    __m256i keys_high = chip8_lockstep_load(&lockstep->keys[16]);
+
+    // Split the 16 bit masks into keys 0-7 and keys 8-15, one byte per lane
+    __m256i first = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(keys_low, low_byte),
+                                                                 _mm256_and_si256(keys_high, low_byte)), 0xD8);
+    __m256i second = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(keys_low, 8),
+                                                                  _mm256_srli_epi16(keys_high, 8)), 0xD8);
+    __m256i held = _mm256_blendv_epi8(second, first, _mm256_cmpgt_epi8(_mm256_set1_epi8(8), x));
+    __m256i bit = _mm256_shuffle_epi8(bits, x);
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_and_si256(held, bit), _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+}
+
+// Runs one instruction on every lane in group. Returns false, without touching
+// anything, for instructions that need per-lane memory, stack, screen or input
+CHIP8_AVX2 static bool chip8_lockstep_exec_avx2(struct chip8_lockstep* lockstep, unsigned int group, const struct chip8_instruction* ins)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i ones = _mm256_set1_epi8(-1);
+    __m256i mask = chip8_lockstep_byte_mask(group);
+    unsigned char* vx = lockstep->V[ins->x];
+    unsigned char* vy = lockstep->V[ins->y];
+    unsigned char* vf = lockstep->V[0x0f];
+    __m256i x = chip8_lockstep_load(vx);
+    __m256i y = chip8_lockstep_load(vy);
+    __m256i skip = zero;
+
+    // VF is written before Vx is recomputed, as the reference handlers do, so
+    // x or y naming VF behaves the same
+    switch(ins->op)
+    {
+        case CHIP8_OP_JP:
+            chip8_lockstep_set_words(lockstep->PC, ins->nnn, mask);
+            return true;
+
+        case CHIP8_OP_SE_BYTE:
+            skip = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(ins->kk));
+        break;
+
+        case CHIP8_OP_SNE_BYTE:
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(ins->kk)), ones);
+        break;
+
+        case CHIP8_OP_SE_REG:
+            skip = _mm256_cmpeq_epi8(x, y);
+        break;
+
+        case CHIP8_OP_SNE_REG:
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(x, y), ones);
+        break;
+
+        case CHIP8_OP_LD_BYTE:
+            chip8_lockstep_store_masked(vx, _mm256_set1_epi8(ins->kk), mask);
+        break;
+
+        case CHIP8_OP_ADD_BYTE:
+            chip8_lockstep_store_masked(vx, _mm256_add_epi8(x, _mm256_set1_epi8(ins->kk)), mask);
+        break;
+
+        case CHIP8_OP_LD_REG:
+            chip8_lockstep_store_masked(vx, y, mask);
+        break;
+
+        case CHIP8_OP_OR:
+            chip8_lockstep_store_masked(vx, _mm256_or_si256(x, y), mask);
+        break;
+
+        case CHIP8_OP_AND:
+            chip8_lockstep_store_masked(vx, _mm256_and_si256(x, y), mask);
+        break;
+
+        case CHIP8_OP_XOR:
+            chip8_lockstep_store_masked(vx, _mm256_xor_si256(x, y), mask);
+        break;
+
+        case CHIP8_OP_ADD_REG:{
+            // A wrapped sum differs from the saturated one exactly when it carried
+            __m256i sum = _mm256_add_epi8(x, y);
+            chip8_lockstep_store_masked(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(x, y), sum), one), mask);
+            chip8_lockstep_store_masked(vx, sum, mask);
+        }
+        break;
+
+        case CHIP8_OP_SUB:
+            chip8_lockstep_store_masked(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(x, y), zero), one), mask);
+            x = chip8_lockstep_load(vx);
+            y = chip8_lockstep_load(vy);
+            chip8_lockstep_store_masked(vx, _mm256_sub_epi8(x, y), mask);
+        break;
+
+        case CHIP8_OP_SHR:
+            chip8_lockstep_store_masked(vf, _mm256_and_si256(x, one), mask);
+            x = chip8_lockstep_load(vx);
+            chip8_lockstep_store_masked(vx, _mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi8(0x7f)), mask);
+        break;
+
+        case CHIP8_OP_SUBN:
+            chip8_lockstep_store_masked(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(y, x), zero), one), mask);
+            x = chip8_lockstep_load(vx);
+            y = chip8_lockstep_load(vy);
+            chip8_lockstep_store_masked(vx, _mm256_sub_epi8(y, x), mask);
+        break;
+
+        case CHIP8_OP_SHL:
+            chip8_lockstep_store_masked(vf, _mm256_and_si256(x, _mm256_set1_epi8((char)0x80)), mask);
+            x = chip8_lockstep_load(vx);
+            chip8_lockstep_store_masked(vx, _mm256_add_epi8(x, x), mask);
+        break;
+
+        case CHIP8_OP_SKP:
+        case CHIP8_OP_SKNP:{
+            // Out of range keys are left to the one-lane path, which asserts
+            __m256i valid = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(15)), x);
+            if(((unsigned int)_mm256_movemask_epi8(valid) & group) != group)
+                return false;
+
+            skip = chip8_lockstep_keys_down(lockstep, x);
+            if(ins->op == CHIP8_OP_SKNP)
+                skip = _mm256_xor_si256(skip, ones);
+        }
+        break;
+
+        case CHIP8_OP_LD_I:
+            chip8_lockstep_set_words(lockstep->I, ins->nnn, mask);
+        break;
+
+        case CHIP8_OP_LD_MEM_VX:
+        case CHIP8_OP_LD_VX_MEM:{
+            // With a shared I the lanes' copies of each address form one row
+            unsigned short i = lockstep->I[chip8_lockstep_first_lane(group)];
+            if(!chip8_lockstep_same_i(lockstep, group, i))
+                return false;
+
+            assert(i + ins->x < CHIP8_MEMORY_SIZE);
+            int r;
+            for(r = 0; r <= ins->x; r++)
+            {
+                if(ins->op == CHIP8_OP_LD_MEM_VX)
+                    chip8_lockstep_store_masked(lockstep->memory[i + r], chip8_lockstep_load(lockstep->V[r]), mask);
+                else
+                    chip8_lockstep_store_masked(lockstep->V[r], chip8_lockstep_load(lockstep->memory[i + r]), mask);
+            }
+        }
+        break;
+
+        case CHIP8_OP_ADD_I_VX:
+            chip8_lockstep_add_bytes_to_words(lockstep->I, x, mask);
+        break;
+
+        case CHIP8_OP_LD_VX_DT:
+            chip8_lockstep_store_masked(vx, chip8_lockstep_load(lockstep->delay_timer), mask);
+        break;
+
+        case CHIP8_OP_LD_DT_VX:
+            chip8_lockstep_store_masked(lockstep->delay_timer, x, mask);
+        break;
+
+        case CHIP8_OP_LD_ST_VX:
+            chip8_lockstep_store_masked(lockstep->sound_timer, x, mask);
+        break;
+
+        default:
+            return false;
+    }
+
+    // Every lane moves past the instruction, skipping lanes past the next one too
+    __m256i step = _mm256_add_epi8(_mm256_set1_epi8(2), _mm256_and_si256(skip, _mm256_set1_epi8(2)));
+    chip8_lockstep_add_words(lockstep->PC, step, mask);
+    return true;
+}
+
+static bool chip8_lockstep_has_avx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static bool chip8_lockstep_has_avx2()
+{
+    return false;
+}
+
+#endif
+
+static unsigned int chip8_lockstep_match(const struct chip8_lockstep* lockstep, int leader, unsigned short pc)
+{
+#ifdef CHIP8_LOCKSTEP_AVX2
+    if(lockstep->vector)
+        return chip8_lockstep_match_avx2(lockstep, leader, pc);
+#endif
+
+    unsigned int group = 0;
+    int lane;
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        if(lockstep->PC[lane] == pc
+           && lockstep->memory[pc][lane] == lockstep->memory[pc][leader]
+           && lockstep->memory[pc + 1][lane] == lockstep->memory[pc + 1][leader])
+            group |= 1u << lane;
+    }
+
+    return group;
+}
+
+static const struct chip8_instruction* chip8_lockstep_decode(struct chip8_lockstep* lockstep, int leader, unsigned short pc)
+{
+    unsigned short opcode = lockstep->memory[pc][leader] << 8 | lockstep->memory[pc + 1][leader];
+    struct chip8_instruction* instruction = &lockstep->decoded[pc];
+    if(!instruction->handler || lockstep->decoded_opcodes[pc] != opcode)
+    {
+        chip8_decode(instruction, opcode);
+        lockstep->decoded_opcodes[pc] = opcode;
+    }
+
+    return instruction;
+}
+
+static void chip8_lockstep_push(struct chip8_lockstep* lockstep, int lane, unsigned short val)
+{
+    lockstep->SP[lane] += 1;
+    assert(lockstep->SP[lane] < CHIP8_TOTAL_STACK_DEPTH);
+    lockstep->stack[lane][lockstep->SP[lane]] = val;
+}
+
+static unsigned short chip8_lockstep_pop(struct chip8_lockstep* lockstep, int lane)
+{
+    assert(lockstep->SP[lane] < CHIP8_TOTAL_STACK_DEPTH);
+    return lockstep->stack[lane][lockstep->SP[lane]--];
+}
+
+static unsigned char* chip8_lockstep_memory(struct chip8_lockstep* lockstep, int lane, int index)
+{
+    assert(index >= 0 && index < CHIP8_MEMORY_SIZE);
+    return &lockstep->memory[index][lane];
+}
+
+// One instruction on one lane, PC already points past it. Mirrors the
+// handlers in chip8.c, including their VF ordering
+static void chip8_lockstep_exec_lane(struct chip8_lockstep* lockstep, int lane, const struct chip8_instruction* ins)
+{
+#define V(index) lockstep->V[(index)][lane]
+    unsigned short* PC = &lockstep->PC[lane];
+    unsigned short* I = &lockstep->I[lane];
+    int i;
+
+    switch(ins->op)
+    {
+        case CHIP8_OP_NOP: break;
+        case CHIP8_OP_CLS: chip8_screen_clear(&lockstep->screens[lane]); break;
+        case CHIP8_OP_RET: *PC = chip8_lockstep_pop(lockstep, lane); break;
+        case CHIP8_OP_JP: *PC = ins->nnn; break;
+        case CHIP8_OP_CALL: chip8_lockstep_push(lockstep, lane, *PC); *PC = ins->nnn; break;
+        case CHIP8_OP_SE_BYTE: if(V(ins->x) == ins->kk) *PC += 2; break;
+        case CHIP8_OP_SNE_BYTE: if(V(ins->x) != ins->kk) *PC += 2; break;
+        case CHIP8_OP_SE_REG: if(V(ins->x) == V(ins->y)) *PC += 2; break;
+        case CHIP8_OP_LD_BYTE: V(ins->x) = ins->kk; break;
+        case CHIP8_OP_ADD_BYTE: V(ins->x) += ins->kk; break;
+        case CHIP8_OP_LD_REG: V(ins->x) = V(ins->y); break;
+        case CHIP8_OP_OR: V(ins->x) = V(ins->x) | V(ins->y); break;
+        case CHIP8_OP_AND: V(ins->x) = V(ins->x) & V(ins->y); break;
+        case CHIP8_OP_XOR: V(ins->x) = V(ins->x) ^ V(ins->y); break;
+
+        case CHIP8_OP_ADD_REG:{
+            unsigned short tmp = V(ins->x) + V(ins->y);
+            V(0x0f) = (tmp > 0xFF);
+            V(ins->x) = tmp;
+        }
+        break;
+
+        case CHIP8_OP_SUB:
+            V(0x0f) = V(ins->x) > V(ins->y);
+            V(ins->x) = V(ins->x) - V(ins->y);
+        break;
+
+        case CHIP8_OP_SHR:
+            V(0x0f) = V(ins->x) & 0x01;
+            V(ins->x) = V(ins->x) / 2;
+        break;
+
+        case CHIP8_OP_SUBN:
+            V(0x0f) = V(ins->y) > V(ins->x);
+            V(ins->x) = V(ins->y) - V(ins->x);
+        break;
+
+        case CHIP8_OP_SHL:
+            V(0x0f) = V(ins->x) & 0b10000000;
+            V(ins->x) = V(ins->x) * 2;
+        break;
+
+        case CHIP8_OP_SNE_REG: if(V(ins->x) != V(ins->y)) *PC += 2; break;
+        case CHIP8_OP_LD_I: *I = ins->nnn; break;
+        case CHIP8_OP_JP_V0: *PC = ins->nnn + V(0x00); break;
+        case CHIP8_OP_RND: V(ins->x) = chip8_random_byte(&lockstep->random[lane]) & ins->kk; break;
+
+        case CHIP8_OP_DRW:{
+            char sprite[16];
+            for(i = 0; i < ins->n; i++)
+                sprite[i] = *chip8_lockstep_memory(lockstep, lane, *I + i);
+
+            V(0x0f) = chip8_screen_draw_sprite(&lockstep->screens[lane], V(ins->x), V(ins->y), sprite, ins->n);
+        }
+        break;
+
+        case CHIP8_OP_SKP:
+            assert(V(ins->x) < CHIP8_TOTAL_KEYS);
+            if((lockstep->keys[lane] >> V(ins->x)) & 1)
+                *PC += 2;
+        break;
+
+        case CHIP8_OP_SKNP:
+            assert(V(ins->x) < CHIP8_TOTAL_KEYS);
+            if(!((lockstep->keys[lane] >> V(ins->x)) & 1))
+                *PC += 2;
+        break;
+
+        case CHIP8_OP_LD_VX_DT: V(ins->x) = lockstep->delay_timer[lane]; break;
+
+        case CHIP8_OP_LD_VX_K:
+            // Same protocol as chip8_keyboard_wait_key: the first pass only arms
+            // the wait, and a waiting lane idles out the rest of the frame
+            if(lockstep->waiting & (1u << lane))
+            {
+                for(i = 0; i < CHIP8_TOTAL_KEYS; i++)
+                {
+                    if(lockstep->wait_pressed[lane] & (1 << i))
+                    {
+                        V(ins->x) = i;
+                        lockstep->waiting &= ~(1u << lane);
+                        return;
+                    }
+                }
+            }
+            else
+            {
+                lockstep->waiting |= 1u << lane;
+                lockstep->wait_pressed[lane] = 0;
+            }
+
+            *PC -= 2;
+            lockstep->idle |= 1u << lane;
+        break;
+
+        case CHIP8_OP_LD_DT_VX: lockstep->delay_timer[lane] = V(ins->x); break;
+        case CHIP8_OP_LD_ST_VX: lockstep->sound_timer[lane] = V(ins->x); break;
+        case CHIP8_OP_ADD_I_VX: *I += V(ins->x); break;
+        case CHIP8_OP_LD_F_VX: *I = V(ins->x) * CHIP8_DEFAULT_SPRITE_HEIGHT; break;
+
+        case CHIP8_OP_LD_B_VX:
+            *chip8_lockstep_memory(lockstep, lane, *I) = V(ins->x) / 100;
+            *chip8_lockstep_memory(lockstep, lane, *I + 1) = V(ins->x) / 10 % 10;
+            *chip8_lockstep_memory(lockstep, lane, *I + 2) = V(ins->x) % 10;
+        break;
+
+        case CHIP8_OP_LD_MEM_VX:
+            for(i = 0; i <= ins->x; i++)
+                *chip8_lockstep_memory(lockstep, lane, *I + i) = V(i);
+        break;
+
+        case CHIP8_OP_LD_VX_MEM:
+            for(i = 0; i <= ins->x; i++)
+                V(i) = *chip8_lockstep_memory(lockstep, lane, *I + i);
+        break;
+
+        default: break;
+    }
+#undef V
+}
+
+static void chip8_lockstep_exec_group(struct chip8_lockstep* lockstep, unsigned int group, const struct chip8_instruction* ins)
+{
+#ifdef CHIP8_LOCKSTEP_AVX2
+    if(lockstep->vector && (group & (group - 1)) && chip8_lockstep_exec_avx2(lockstep, group, ins))
+    {
+        lockstep->vector_instructions += chip8_lockstep_count(group);
+        return;
+    }
+#endif
+
+    for(; group; group &= group - 1)
+    {
+        int lane = chip8_lockstep_first_lane(group);
+        lockstep->PC[lane] += 2;
+        chip8_lockstep_exec_lane(lockstep, lane, ins);
+        lockstep->scalar_instructions++;
+    }
+}
+
+// Every lane becomes a copy of prototype, which should sit on a frame boundary.
+// Keys start released on all lanes
+void chip8_lockstep_init(struct chip8_lockstep* lockstep, const struct chip8* prototype)
+{
+    memset(lockstep, 0, sizeof(struct chip8_lockstep));
+
+    int i, lane;
+    for(i = 0; i < CHIP8_MEMORY_SIZE; i++)
+        memset(lockstep->memory[i], chip8_memory_get(&prototype->memory, i), CHIP8_LOCKSTEP_LANES);
+
+    for(i = 0; i < CHIP8_TOTAL_DATA_REGISTERS; i++)
+        memset(lockstep->V[i], prototype->registers.V[i], CHIP8_LOCKSTEP_LANES);
+
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        lockstep->I[lane] = prototype->registers.I;
+        lockstep->PC[lane] = prototype->registers.PC;
+        lockstep->SP[lane] = prototype->registers.SP;
+        lockstep->delay_timer[lane] = prototype->registers.delay_timer;
+        lockstep->sound_timer[lane] = prototype->registers.sound_timer;
+        memcpy(lockstep->stack[lane], prototype->stack.stack, sizeof(lockstep->stack[lane]));
+        lockstep->screens[lane] = prototype->screen;
+        lockstep->random[lane] = prototype->random;
+    }
+
+    lockstep->cycles_per_frame = prototype->cycles_per_frame;
+    lockstep->frames = prototype->frames;
+    lockstep->cycles = prototype->cycles;
+    lockstep->vector = chip8_lockstep_has_avx2();
+}
+
+void chip8_lockstep_seed(struct chip8_lockstep* lockstep, int lane, unsigned long long seed)
+{
+    assert(lane >= 0 && lane < CHIP8_LOCKSTEP_LANES);
+    chip8_random_seed(&lockstep->random[lane], seed);
+}
+
+// Keys held by lane for the next frame; newly held keys also answer a pending Fx0A
+void chip8_lockstep_set_keys(struct chip8_lockstep* lockstep, int lane, unsigned short keys)
+{
+    assert(lane >= 0 && lane < CHIP8_LOCKSTEP_LANES);
+    lockstep->wait_pressed[lane] |= keys & ~lockstep->keys[lane];
+    lockstep->keys[lane] = keys;
+}
+
+// One frame on every lane: cycles_per_frame steps, each running the lanes in
+// groups that share a PC and opcode, then one tick of the timers
+void chip8_lockstep_run_frame(struct chip8_lockstep* lockstep)
+{
+    lockstep->idle = 0;
+
+    unsigned int step;
+    for(step = 0; step < lockstep->cycles_per_frame; step++)
+    {
+        unsigned int pending = CHIP8_LOCKSTEP_ALL_LANES & ~lockstep->idle;
+        while(pending)
+        {
+            int leader = chip8_lockstep_first_lane(pending);
+            unsigned short pc = lockstep->PC[leader];
+            assert(pc + 1 < CHIP8_MEMORY_SIZE);
+
+            unsigned int group = pending & chip8_lockstep_match(lockstep, leader, pc);
+            pending &= ~group;
+
+            chip8_lockstep_exec_group(lockstep, group, chip8_lockstep_decode(lockstep, leader, pc));
+        }
+    }
+
+    int lane;
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        if(lockstep->delay_timer[lane] > 0)
+            lockstep->delay_timer[lane]--;
+
+        if(lockstep->sound_timer[lane] > 0)
+            lockstep->sound_timer[lane]--;
+    }
+
+    lockstep->frames++;
+    lockstep->cycles += lockstep->cycles_per_frame;
+}
+
+// Copies lane out into an initialised chip8, e.g. to hand it to the full
+// emulator or inspect its screen
+void chip8_lockstep_extract(const struct chip8_lockstep* lockstep, int lane, struct chip8* chip8)
+{
+    assert(lane >= 0 && lane < CHIP8_LOCKSTEP_LANES);
+
+    int i;
+    for(i = 0; i < CHIP8_MEMORY_SIZE; i++)
+    {
+        if(chip8_memory_get(&chip8->memory, i) != lockstep->memory[i][lane])
+            chip8_memory_set(&chip8->memory, i, lockstep->memory[i][lane]);
+    }
+
+    for(i = 0; i < CHIP8_TOTAL_DATA_REGISTERS; i++)
+        chip8->registers.V[i] = lockstep->V[i][lane];
+
+    chip8->registers.I = lockstep->I[lane];
+    chip8->registers.PC = lockstep->PC[lane];
+    chip8->registers.SP = lockstep->SP[lane];
+    chip8->registers.delay_timer = lockstep->delay_timer[lane];
+    chip8->registers.sound_timer = lockstep->sound_timer[lane];
+    memcpy(chip8->stack.stack, lockstep->stack[lane], sizeof(chip8->stack.stack));
+    chip8->screen = lockstep->screens[lane];
+    chip8->random = lockstep->random[lane];
+    chip8->cycles_per_frame = lockstep->cycles_per_frame;
+    chip8->frame_cycles = 0;
+    chip8->frames = lockstep->frames;
+    chip8->cycles = lockstep->cycles;
+
+    chip8_instruction_cache_clear(&chip8->instructions);
+    if(chip8->jit)
+        chip8_jit_flush(chip8->jit);
+}
@@ -1,27 +1,91 @@
 #include "chip8_memory.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef char chip8_memory_owned_fits[CHIP8_MEMORY_TOTAL_PAGES <= 32 ? 1 : -1];
+typedef char chip8_memory_dirty_fits[CHIP8_MEMORY_TOTAL_BLOCKS <= 64 && CHIP8_MEMORY_PAGE_SIZE % CHIP8_MEMORY_BLOCK_SIZE == 0 ? 1 : -1];
 
 static void chip8_is_memory_in_bounds(int index)
 {
     assert(index >= 0 && index < CHIP8_MEMORY_SIZE);
 }
 
-void chip8_memory_set(struct chip8_memory* memory, int index, unsigned char val)
+// Maps every page onto image, which must hold CHIP8_MEMORY_SIZE bytes and
+// outlive the mapping
+void chip8_memory_init(struct chip8_memory* memory, const unsigned char* image)
+{
+    int page;
+    for(page = 0; page < CHIP8_MEMORY_TOTAL_PAGES; page++)
+        memory->pages[page] = &image[page * CHIP8_MEMORY_PAGE_SIZE];
+
+    // Everything may differ from what the memory held before
+    memory->owned = 0;
+    memory->dirty = ~0ULL;
+    memory->failed = false;
+}
+
+void chip8_memory_destroy(struct chip8_memory* memory)
+{
+    int page;
+    for(page = 0; page < CHIP8_MEMORY_TOTAL_PAGES; page++)
+    {
+        if(memory->owned & (1u << page))
+            free((unsigned char*)memory->pages[page]);
+    }
+
+    memory->owned = 0;
+}
+
+// Returns false, leaving the page as it was, when its private copy cannot be allocated
+bool chip8_memory_set(struct chip8_memory* memory, int index, unsigned char val)
 {
     chip8_is_memory_in_bounds(index);
-    memory->memory[index] = val;
+
+    int page = index / CHIP8_MEMORY_PAGE_SIZE;
+    if(!(memory->owned & (1u << page)))
+    {
+        unsigned char* copy = malloc(CHIP8_MEMORY_PAGE_SIZE);
+        if(!copy)
+        {
+            memory->failed = true;
+            return false;
+        }
+        memcpy(copy, memory->pages[page], CHIP8_MEMORY_PAGE_SIZE);
+        memory->pages[page] = copy;
+        memory->owned |= 1u << page;
+    }
+
+    ((unsigned char*)memory->pages[page])[index % CHIP8_MEMORY_PAGE_SIZE] = val;
+    memory->dirty |= 1ULL << (index / CHIP8_MEMORY_BLOCK_SIZE);
+    return true;
 }
 
-unsigned char chip8_memory_get(struct chip8_memory* memory, int index)
+unsigned char chip8_memory_get(const struct chip8_memory* memory, int index)
 {
     chip8_is_memory_in_bounds(index);
-    return memory->memory[index];
+    return memory->pages[index / CHIP8_MEMORY_PAGE_SIZE][index % CHIP8_MEMORY_PAGE_SIZE];
 }
 
-unsigned short chip8_memory_get_short(struct chip8_memory* memory, int index)
+unsigned short chip8_memory_get_short(const struct chip8_memory* memory, int index)
 {
     unsigned char byte1 = chip8_memory_get(memory, index);
     unsigned char byte2 = chip8_memory_get(memory, index + 1);
 
     return byte1 << 8 | byte2;
-}
\ No newline at end of file
+}
+
+// Blocks never straddle pages, so a block is CHIP8_MEMORY_BLOCK_SIZE contiguous bytes
+const unsigned char* chip8_memory_block(const struct chip8_memory* memory, int block)
+{
+    assert(block >= 0 && block < CHIP8_MEMORY_TOTAL_BLOCKS);
+    int index = block * CHIP8_MEMORY_BLOCK_SIZE;
+    return &memory->pages[index / CHIP8_MEMORY_PAGE_SIZE][index % CHIP8_MEMORY_PAGE_SIZE];
+}
+
+unsigned long long chip8_memory_fetch_dirty(struct chip8_memory* memory)
+{
+    unsigned long long dirty = memory->dirty;
+    memory->dirty = 0;
+    return dirty;
+}
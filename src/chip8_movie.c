@@ -0,0 +1,219 @@
+#include "chip8_movie.h"
+#include "chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout: this header, then one record per event: the cycles since the
+// previous event as a little-endian base 128 varint, then key | down << 4
+struct chip8_movie_header
+{
+    char magic[4];
+    unsigned int version;
+    unsigned long long random;
+    unsigned int cycles_per_frame;
+    unsigned int total_events;
+};
+
+void chip8_movie_init(struct chip8_movie* movie)
+{
+    memset(movie, 0, sizeof(struct chip8_movie));
+}
+
+void chip8_movie_destroy(struct chip8_movie* movie)
+{
+    free(movie->events);
+    chip8_movie_init(movie);
+}
+
+// Starts a recording of chip8, which should have just loaded its ROM
+void chip8_movie_begin(struct chip8_movie* movie, const struct chip8* chip8)
+{
+    movie->random = chip8->random.state;
+    movie->cycles_per_frame = chip8->cycles_per_frame;
+    movie->total_events = 0;
+    movie->next = 0;
+    movie->incomplete = false;
+}
+
+// Returns false, keeping the events so far, when there is no room for another
+static bool chip8_movie_add(struct chip8_movie* movie, unsigned long long cycle, int key, bool down)
+{
+    if(movie->total_events == movie->max_events)
+    {
+        int max_events = movie->max_events ? movie->max_events * 2 : 256;
+        struct chip8_movie_event* events = realloc(movie->events, max_events * sizeof(struct chip8_movie_event));
+        if(!events)
+            return false;
+
+        movie->events = events;
+        movie->max_events = max_events;
+    }
+
+    struct chip8_movie_event* event = &movie->events[movie->total_events++];
+    event->cycle = cycle;
+    event->key = key;
+    event->down = down;
+    return true;
+}
+
+// Called by the core right after it latched the keyboard. Each edge becomes
+// one transition; a key both pressed and released within the frame is
+// replayed in the order that leaves it where the latch found it
+void chip8_movie_record(struct chip8_movie* movie, const struct chip8* chip8)
+{
+    const struct chip8_keyboard* keyboard = &chip8->keyboard;
+    if(!(keyboard->frame_pressed | keyboard->frame_released))
+        return;
+
+    int key;
+    for(key = 0; key < CHIP8_TOTAL_KEYS; key++)
+    {
+        bool pressed = (keyboard->frame_pressed >> key) & 1;
+        bool released = (keyboard->frame_released >> key) & 1;
+        bool down = (keyboard->frame_down >> key) & 1;
+        bool added = true;
+        if(pressed && released)
+            added = chip8_movie_add(movie, chip8->cycles, key, !down) && chip8_movie_add(movie, chip8->cycles, key, down);
+        else if(pressed || released)
+            added = chip8_movie_add(movie, chip8->cycles, key, pressed);
+
+        if(!added)
+            movie->incomplete = true;
+    }
+}
+
+// Forgets everything from cycle on, for a recording machine that was rewound there
+void chip8_movie_truncate(struct chip8_movie* movie, unsigned long long cycle)
+{
+    while(movie->total_events > 0 && movie->events[movie->total_events - 1].cycle >= cycle)
+        movie->total_events--;
+}
+
+// Returns false without writing anything for a recording that lost events
+bool chip8_movie_save(const struct chip8_movie* movie, const char* filename)
+{
+    if(movie->incomplete)
+        return false;
+
+    FILE* f = fopen(filename, "wb");
+    if(!f)
+        return false;
+
+    struct chip8_movie_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_MOVIE_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_MOVIE_VERSION;
+    header.random = movie->random;
+    header.cycles_per_frame = movie->cycles_per_frame;
+    header.total_events = movie->total_events;
+    fwrite(&header, sizeof(header), 1, f);
+
+    unsigned long long cycle = 0;
+    int i;
+    for(i = 0; i < movie->total_events; i++)
+    {
+        const struct chip8_movie_event* event = &movie->events[i];
+        unsigned long long delta = event->cycle - cycle;
+        cycle = event->cycle;
+
+        do
+        {
+            fputc((delta & 0x7f) | (delta >= 0x80 ? 0x80 : 0), f);
+            delta >>= 7;
+        }
+        while(delta);
+        fputc(event->key | event->down << 4, f);
+    }
+
+    bool saved = !ferror(f);
+    if(fclose(f) != 0)
+        saved = false;
+    return saved;
+}
+
+bool chip8_movie_load(struct chip8_movie* movie, const char* filename)
+{
+    FILE* f = fopen(filename, "rb");
+    if(!f)
+        return false;
+
+    struct chip8_movie_header header;
+    if(fread(&header, sizeof(header), 1, f) != 1 ||
+       memcmp(header.magic, CHIP8_MOVIE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != CHIP8_MOVIE_VERSION || header.cycles_per_frame == 0)
+    {
+        fclose(f);
+        return false;
+    }
+
+    movie->random = header.random;
+    movie->cycles_per_frame = header.cycles_per_frame;
+    movie->total_events = 0;
+    movie->next = 0;
+    movie->incomplete = false;
+
+    unsigned long long cycle = 0;
+    unsigned int i;
+    for(i = 0; i < header.total_events; i++)
+    {
+        unsigned long long delta = 0;
+        int shift = 0, c;
+        do
+        {
+            c = fgetc(f);
+            if(c == EOF || shift > 63)
+            {
+                fclose(f);
+                return false;
+            }
+            delta |= (unsigned long long)(c & 0x7f) << shift;
+            shift += 7;
+        }
+        while(c & 0x80);
+
+        int key = fgetc(f);
+        if(key == EOF || (key & 0x0f) >= CHIP8_TOTAL_KEYS)
+        {
+            fclose(f);
+            return false;
+        }
+
+        cycle += delta;
+        if(!chip8_movie_add(movie, cycle, key & 0x0f, (key >> 4) & 1))
+        {
+            fclose(f);
+            return false;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+// Puts chip8, freshly loaded with the movie's ROM, in the state the recording started from
+void chip8_movie_start(struct chip8_movie* movie, struct chip8* chip8)
+{
+    movie->next = 0;
+    chip8->random.state = movie->random;
+    chip8_set_cycles_per_frame(chip8, movie->cycles_per_frame);
+}
+
+// Feeds the transitions due by now; call it before every chip8_run. Frames
+// never straddle a chip8_run call, so every latch happens at the start of one
+void chip8_movie_play(struct chip8_movie* movie, struct chip8* chip8)
+{
+    while(movie->next < movie->total_events && movie->events[movie->next].cycle <= chip8->cycles)
+    {
+        const struct chip8_movie_event* event = &movie->events[movie->next++];
+        if(event->down)
+            chip8_keyboard_down(&chip8->keyboard, event->key);
+        else
+            chip8_keyboard_up(&chip8->keyboard, event->key);
+    }
+}
+
+bool chip8_movie_is_done(const struct chip8_movie* movie)
+{
+    return movie->next == movie->total_events;
+}
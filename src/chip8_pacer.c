@@ -0,0 +1,63 @@
+#include "chip8_pacer.h"
+#include <errno.h>
+
+#define CHIP8_NSEC_PER_SEC 1000000000L
+
+static long long chip8_pacer_ns(const struct timespec* time)
+{
+    return (long long)time->tv_sec * CHIP8_NSEC_PER_SEC + time->tv_nsec;
+}
+
+void chip8_pacer_init(struct chip8_pacer* pacer, unsigned int frames_per_second)
+{
+    pacer->period_ns = CHIP8_NSEC_PER_SEC / frames_per_second;
+    chip8_pacer_reset(pacer);
+}
+
+void chip8_pacer_reset(struct chip8_pacer* pacer)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pacer->deadline);
+}
+
+void chip8_pacer_wait(struct chip8_pacer* pacer)
+{
+    pacer->deadline.tv_nsec += pacer->period_ns;
+    while(pacer->deadline.tv_nsec >= CHIP8_NSEC_PER_SEC)
+    {
+        pacer->deadline.tv_nsec -= CHIP8_NSEC_PER_SEC;
+        pacer->deadline.tv_sec++;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Too far behind (suspended, debugger, overloaded host): drop the backlog
+    // instead of running a burst of frames to catch up
+    if(chip8_pacer_ns(&now) - chip8_pacer_ns(&pacer->deadline) > CHIP8_PACER_MAX_LAG_FRAMES * pacer->period_ns)
+    {
+        pacer->deadline = now;
+        return;
+    }
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pacer->deadline, NULL) == EINTR)
+        ;
+}
+
+// Never sleeps: true at most once per period, for work that has to keep
+// wall-clock time while the frames themselves run unpaced
+bool chip8_pacer_is_due(struct chip8_pacer* pacer)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(chip8_pacer_ns(&now) < chip8_pacer_ns(&pacer->deadline))
+        return false;
+
+    pacer->deadline = now;
+    pacer->deadline.tv_nsec += pacer->period_ns;
+    while(pacer->deadline.tv_nsec >= CHIP8_NSEC_PER_SEC)
+    {
+        pacer->deadline.tv_nsec -= CHIP8_NSEC_PER_SEC;
+        pacer->deadline.tv_sec++;
+    }
+    return true;
+}
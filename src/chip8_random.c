@@ -0,0 +1,24 @@
+#include "chip8_random.h"
+
+void chip8_random_seed(struct chip8_random* random, unsigned long long seed)
+{
+    // splitmix64 spreads any seed, including 0, over a non-zero xorshift state
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+
+    random->state = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+unsigned char chip8_random_byte(struct chip8_random* random)
+{
+    // xorshift64*, the top byte has the best statistical quality
+    unsigned long long x = random->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    random->state = x;
+
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
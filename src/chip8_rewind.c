@@ -0,0 +1,210 @@
+#include "chip8_rewind.h"
+#include <assert.h>
+#include <string.h>
+
+// Encoding, one header byte per run:
+//   0x00-0x7f  n + 1 literal bytes follow
+//   0x80-0xbf  (n & 0x3f) + 1 zero bytes
+//   0xc0-0xff  ((n & 0x3f) << 8 | next byte) + 1 zero bytes
+// A delta XORs its literals into the previous state and skips its zero runs
+#define CHIP8_REWIND_MAX_LITERAL 0x80
+#define CHIP8_REWIND_MAX_SHORT_ZEROS 0x40
+#define CHIP8_REWIND_MAX_ZEROS 0x4000
+
+typedef char chip8_rewind_state_fits[sizeof(struct chip8_state) <= CHIP8_REWIND_BUFFER_SIZE / 4 ? 1 : -1];
+
+void chip8_rewind_init(struct chip8_rewind* rewind)
+{
+    rewind->head = 0;
+    rewind->first = 0;
+    rewind->total_frames = 0;
+    rewind->since_keyframe = 0;
+}
+
+// Encodes state, or its XOR against base when base is not NULL
+static unsigned int chip8_rewind_encode(unsigned char* out, const unsigned char* state, const unsigned char* base, unsigned int size)
+{
+    unsigned int i = 0, n = 0;
+    while(i < size)
+    {
+        unsigned int run = 0;
+        while(i + run < size && run < CHIP8_REWIND_MAX_ZEROS && (state[i + run] ^ (base ? base[i + run] : 0)) == 0)
+            run++;
+
+        if(run > CHIP8_REWIND_MAX_SHORT_ZEROS)
+        {
+            out[n++] = 0xc0 | ((run - 1) >> 8);
+            out[n++] = (run - 1) & 0xff;
+            i += run;
+            continue;
+        }
+        if(run > 0)
+        {
+            out[n++] = 0x80 | (run - 1);
+            i += run;
+            continue;
+        }
+
+        // Literals run until two zeros in a row, which are cheaper as a zero run
+        unsigned int length = 0;
+        unsigned char* header = &out[n++];
+        while(i < size && length < CHIP8_REWIND_MAX_LITERAL)
+        {
+            unsigned char d = state[i] ^ (base ? base[i] : 0);
+            if(d == 0 && i + 1 < size && (state[i + 1] ^ (base ? base[i + 1] : 0)) == 0)
+                break;
+
+            out[n++] = d;
+            length++;
+            i++;
+        }
+        *header = length - 1;
+    }
+
+    assert(n <= CHIP8_REWIND_MAX_RECORD_SIZE);
+    return n;
+}
+
+// A keyframe overwrites state, a delta is XORed into it
+static void chip8_rewind_decode(unsigned char* state, const unsigned char* in, unsigned int in_size, bool keyframe)
+{
+    unsigned int i = 0, n = 0;
+    while(n < in_size)
+    {
+        unsigned char header = in[n++];
+        if(header < 0x80)
+        {
+            unsigned int length = header + 1;
+            unsigned int k;
+            for(k = 0; k < length; k++)
+                state[i + k] = keyframe ? in[n + k] : state[i + k] ^ in[n + k];
+            n += length;
+            i += length;
+            continue;
+        }
+
+        unsigned int run = (header & 0x3f) + 1;
+        if(header >= 0xc0)
+            run = ((header & 0x3f) << 8 | in[n++]) + 1;
+        if(keyframe)
+            memset(&state[i], 0, run);
+        i += run;
+    }
+}
+
+static struct chip8_rewind_frame* chip8_rewind_frame(struct chip8_rewind* rewind, int index)
+{
+    return &rewind->frames[(rewind->first + index) % CHIP8_REWIND_MAX_FRAMES];
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+static void chip8_rewind_drop_oldest(struct chip8_rewind* rewind)
+{
+    do
+    {
+        rewind->first = (rewind->first + 1) % CHIP8_REWIND_MAX_FRAMES;
+        rewind->total_frames--;
+    }
+    while(rewind->total_frames > 0 && !chip8_rewind_frame(rewind, 0)->keyframe);
+
+    if(rewind->total_frames == 0)
+        rewind->head = 0;
+}
+
+// Finds size contiguous bytes after the newest frame, wrapping to the start of
+// the buffer when the end is too short
+static bool chip8_rewind_reserve(struct chip8_rewind* rewind, unsigned int size)
+{
+    if(rewind->total_frames == 0)
+        return true;
+
+    unsigned int tail = chip8_rewind_frame(rewind, 0)->offset;
+    if(rewind->head > tail)
+    {
+        if(CHIP8_REWIND_BUFFER_SIZE - rewind->head >= size)
+            return true;
+        if(tail >= size)
+        {
+            rewind->head = 0;
+            return true;
+        }
+        return false;
+    }
+
+    return tail - rewind->head >= size;
+}
+
+// Records chip8 as the newest frame; call it before running each frame
+void chip8_rewind_push(struct chip8_rewind* rewind, const struct chip8* chip8)
+{
+    chip8_state_capture(chip8, &rewind->capture);
+
+    bool keyframe = rewind->total_frames == 0 || rewind->since_keyframe + 1 >= CHIP8_REWIND_KEYFRAME_INTERVAL;
+    unsigned int size = chip8_rewind_encode(rewind->record, (const unsigned char*)&rewind->capture,
+                                            keyframe ? NULL : (const unsigned char*)&rewind->last, sizeof(struct chip8_state));
+
+    while(rewind->total_frames == CHIP8_REWIND_MAX_FRAMES || !chip8_rewind_reserve(rewind, size))
+    {
+        // Dropping the only keyframe left also drops the base of this delta
+        chip8_rewind_drop_oldest(rewind);
+        if(rewind->total_frames == 0 && !keyframe)
+        {
+            keyframe = true;
+            size = chip8_rewind_encode(rewind->record, (const unsigned char*)&rewind->capture, NULL, sizeof(struct chip8_state));
+        }
+    }
+
+    struct chip8_rewind_frame* frame = chip8_rewind_frame(rewind, rewind->total_frames++);
+    frame->offset = rewind->head;
+    frame->size = size;
+    frame->keyframe = keyframe;
+    memcpy(&rewind->buffer[rewind->head], rewind->record, size);
+    rewind->head += size;
+
+    rewind->since_keyframe = keyframe ? 0 : rewind->since_keyframe + 1;
+    memcpy(&rewind->last, &rewind->capture, sizeof(struct chip8_state));
+}
+
+// Puts chip8 back to the newest frame and forgets it, so each call goes one
+// frame further back. Rebuilding the frame before it decodes at most one
+// keyframe interval. Returns false once the history is empty
+bool chip8_rewind_back(struct chip8_rewind* rewind, struct chip8* chip8)
+{
+    if(rewind->total_frames == 0)
+        return false;
+
+    chip8_state_restore_private(chip8, &rewind->last);
+
+    rewind->total_frames--;
+    rewind->head = chip8_rewind_frame(rewind, rewind->total_frames)->offset;
+    if(rewind->total_frames == 0)
+    {
+        rewind->head = 0;
+        return true;
+    }
+
+    int keyframe = rewind->total_frames - 1;
+    while(!chip8_rewind_frame(rewind, keyframe)->keyframe)
+        keyframe--;
+
+    unsigned char* last = (unsigned char*)&rewind->last;
+    int i;
+    for(i = keyframe; i < rewind->total_frames; i++)
+    {
+        const struct chip8_rewind_frame* frame = chip8_rewind_frame(rewind, i);
+        chip8_rewind_decode(last, &rewind->buffer[frame->offset], frame->size, frame->keyframe);
+    }
+    rewind->since_keyframe = rewind->total_frames - 1 - keyframe;
+
+    return true;
+}
+
+// Bytes of encoded history currently held
+unsigned int chip8_rewind_size(const struct chip8_rewind* rewind)
+{
+    unsigned int size = 0;
+    int i;
+    for(i = 0; i < rewind->total_frames; i++)
+        size += rewind->frames[(rewind->first + i) % CHIP8_REWIND_MAX_FRAMES].size;
+    return size;
+}
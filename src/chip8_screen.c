@@ -11,38 +11,84 @@ static void chip8_screen_check_bounds(int x, int y)
 void chip8_screen_set(struct chip8_screen* screen, int x, int y)
 {
     chip8_screen_check_bounds(x, y);
-    screen->pixels[y][x] = true;
+    screen->rows[y] |= 1ULL << (CHIP8_WIDTH - 1 - x);
+    screen->dirty |= 1u << y;
+    screen->changed |= 1u << y;
 }
 
 void chip8_screen_clear(struct chip8_screen* screen)
 {
-    memset(screen->pixels, 0, sizeof(screen->pixels));
+    int y;
+    for(y = 0; y < CHIP8_HEIGHT; y++)
+    {
+        if(screen->rows[y])
+        {
+            screen->dirty |= 1u << y;
+            screen->changed |= 1u << y;
+        }
+    }
+
+    memset(screen->rows, 0, sizeof(screen->rows));
 }
 
 bool chip8_screen_is_set(struct chip8_screen* screen, int x, int y)
 {
     chip8_screen_check_bounds(x, y);
-    return screen->pixels[y][x];
+    return (screen->rows[y] >> (CHIP8_WIDTH - 1 - x)) & 1;
 }
 
 bool chip8_screen_draw_sprite(struct chip8_screen* screen, int x, int y, const char* sprite, int num)
 {
-    bool pixel_collision = false;
-    int lx, ly;
+    unsigned long long pixel_collision = 0;
+    int shift = x % CHIP8_WIDTH;
+    int ly;
     for(ly = 0; ly < num; ly++){
-        char c = sprite[ly];
-        for(lx = 0; lx < 8; lx++)
-        {
-            if((c & (0b10000000 >> lx)) == 0)
-                continue;
+        unsigned long long line = (unsigned long long)(unsigned char)sprite[ly] << (CHIP8_WIDTH - 8);
+
+        // Rotating instead of shifting wraps the sprite around the right edge
+        if(shift)
+            line = (line >> shift) | (line << (CHIP8_WIDTH - shift));
+
+        if(!line)
+            continue;
+
+        int row_y = (ly+y) % CHIP8_HEIGHT;
+        unsigned long long* row = &screen->rows[row_y];
+        pixel_collision |= *row & line;
+        *row ^= line;
+        screen->dirty |= 1u << row_y;
+        screen->changed |= 1u << row_y;
+    }
+    return pixel_collision != 0;
+}
 
-            if(screen->pixels[(ly+y) % CHIP8_HEIGHT][(lx+x) % CHIP8_WIDTH])
-            {
-                pixel_collision = true;
-            }
+unsigned int chip8_screen_fetch_dirty(struct chip8_screen* screen)
+{
+    unsigned int dirty = screen->dirty;
+    screen->dirty = 0;
+    return dirty;
+}
 
-            screen->pixels[(ly+y) % CHIP8_HEIGHT][(lx+x) % CHIP8_WIDTH] ^= true;
+unsigned int chip8_screen_fetch_changed(struct chip8_screen* screen)
+{
+    unsigned int changed = screen->changed;
+    screen->changed = 0;
+    return changed;
+}
+
+// FNV-1a over the packed rows, a cheap fingerprint of the frame for regression runs
+unsigned long long chip8_screen_hash(const struct chip8_screen* screen)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    int y, i;
+    for(y = 0; y < CHIP8_HEIGHT; y++)
+    {
+        for(i = 0; i < 8; i++)
+        {
+            hash ^= (screen->rows[y] >> (i * 8)) & 0xff;
+            hash *= 0x100000001b3ULL;
         }
     }
-    return pixel_collision;
+
+    return hash;
 }
\ No newline at end of file
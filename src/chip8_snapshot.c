@@ -0,0 +1,73 @@
+#include "chip8_snapshot.h"
+#include <string.h>
+
+static int chip8_snapshot_count(unsigned long long mask)
+{
+    int count = 0;
+    for(; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+// Takes a full copy and starts tracking chip8 from it
+void chip8_snapshot_init(struct chip8_snapshot* snapshot, struct chip8* chip8)
+{
+    chip8_state_capture(chip8, &snapshot->state);
+    chip8_memory_fetch_dirty(&chip8->memory);
+    chip8_screen_fetch_changed(&chip8->screen);
+
+    snapshot->copied_blocks = CHIP8_MEMORY_TOTAL_BLOCKS;
+    snapshot->copied_rows = CHIP8_HEIGHT;
+}
+
+void chip8_snapshot_save(struct chip8_snapshot* snapshot, struct chip8* chip8)
+{
+    unsigned long long dirty = chip8_memory_fetch_dirty(&chip8->memory);
+    unsigned int changed = chip8_screen_fetch_changed(&chip8->screen);
+
+    int block;
+    for(block = 0; block < CHIP8_MEMORY_TOTAL_BLOCKS; block++)
+    {
+        if(dirty & (1ULL << block))
+            memcpy(&snapshot->state.image.memory[block * CHIP8_MEMORY_BLOCK_SIZE], chip8_memory_block(&chip8->memory, block), CHIP8_MEMORY_BLOCK_SIZE);
+    }
+
+    int y;
+    for(y = 0; y < CHIP8_HEIGHT; y++)
+    {
+        if(changed & (1u << y))
+            snapshot->state.screen[y] = chip8->screen.rows[y];
+    }
+
+    chip8_state_capture_registers(chip8, &snapshot->state);
+    snapshot->copied_blocks = chip8_snapshot_count(dirty);
+    snapshot->copied_rows = chip8_snapshot_count(changed);
+}
+
+void chip8_snapshot_restore(struct chip8_snapshot* snapshot, struct chip8* chip8)
+{
+    unsigned long long dirty = chip8_memory_fetch_dirty(&chip8->memory);
+    unsigned int changed = chip8_screen_fetch_changed(&chip8->screen);
+
+    int block;
+    for(block = 0; block < CHIP8_MEMORY_TOTAL_BLOCKS; block++)
+    {
+        if(dirty & (1ULL << block))
+            chip8_state_restore_block(chip8, &snapshot->state, block);
+    }
+
+    // The write-back above is not a change relative to the snapshot
+    chip8_memory_fetch_dirty(&chip8->memory);
+
+    int y;
+    for(y = 0; y < CHIP8_HEIGHT; y++)
+    {
+        if(changed & (1u << y))
+            chip8->screen.rows[y] = snapshot->state.screen[y];
+    }
+    chip8->screen.dirty |= changed;
+
+    chip8_state_restore_registers(chip8, &snapshot->state);
+    snapshot->copied_blocks = chip8_snapshot_count(dirty);
+    snapshot->copied_rows = chip8_snapshot_count(changed);
+}
@@ -0,0 +1,204 @@
+#include "chip8_state.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Everything but memory and the screen, which are large enough to be worth
+// tracking; see chip8_snapshot
+void chip8_state_capture_registers(const struct chip8* chip8, struct chip8_state* state)
+{
+    state->cycles_per_frame = chip8->cycles_per_frame;
+    state->frame_cycles = chip8->frame_cycles;
+    state->cycles = chip8->cycles;
+    state->frames = chip8->frames;
+    state->random = chip8->random.state;
+
+    memcpy(state->stack, chip8->stack.stack, sizeof(state->stack));
+    state->I = chip8->registers.I;
+    state->PC = chip8->registers.PC;
+
+    // Edges the host posted but the core has not latched yet are kept apart
+    // from the latched ones, so a state taken mid-frame replays the same latch
+    const struct chip8_keyboard* keyboard = &chip8->keyboard;
+    chip8_keyboard_load_host(keyboard, &state->keys_down, &state->keys_pressed, &state->keys_released);
+    state->keys_state = keyboard->state;
+    state->frame_pressed = keyboard->frame_pressed;
+    state->frame_released = keyboard->frame_released;
+    state->wait_pressed = keyboard->wait_pressed;
+    state->waiting = atomic_load(&keyboard->waiting);
+
+    memcpy(state->V, chip8->registers.V, sizeof(state->V));
+    state->delay_timer = chip8->registers.delay_timer;
+    state->sound_timer = chip8->registers.sound_timer;
+    state->SP = chip8->registers.SP;
+}
+
+void chip8_state_restore_registers(struct chip8* chip8, const struct chip8_state* state)
+{
+    chip8->cycles_per_frame = state->cycles_per_frame;
+    chip8->frame_cycles = state->frame_cycles;
+    chip8->cycles = state->cycles;
+    chip8->frames = state->frames;
+    chip8->key_wait = false;
+    chip8->random.state = state->random;
+
+    memcpy(chip8->stack.stack, state->stack, sizeof(chip8->stack.stack));
+    memcpy(chip8->registers.V, state->V, sizeof(chip8->registers.V));
+    chip8->registers.I = state->I;
+    chip8->registers.PC = state->PC;
+    chip8->registers.delay_timer = state->delay_timer;
+    chip8->registers.sound_timer = state->sound_timer;
+    chip8->registers.SP = state->SP;
+
+    chip8_keyboard_store_host(&chip8->keyboard, state->keys_down, state->keys_pressed, state->keys_released);
+    chip8->keyboard.state = state->keys_state;
+    chip8->keyboard.frame_pressed = state->frame_pressed;
+    chip8->keyboard.frame_released = state->frame_released;
+    chip8->keyboard.wait_pressed = state->wait_pressed;
+    atomic_store(&chip8->keyboard.waiting, state->waiting != 0);
+}
+
+void chip8_state_capture(const struct chip8* chip8, struct chip8_state* state)
+{
+    memset(state, 0, sizeof(struct chip8_state));
+    memcpy(state->magic, CHIP8_STATE_MAGIC, sizeof(state->magic));
+    state->version = CHIP8_STATE_VERSION;
+    state->size = sizeof(struct chip8_state);
+
+    chip8_state_capture_registers(chip8, state);
+    memcpy(state->screen, chip8->screen.rows, sizeof(state->screen));
+
+    int block;
+    for(block = 0; block < CHIP8_MEMORY_TOTAL_BLOCKS; block++)
+        memcpy(&state->image.memory[block * CHIP8_MEMORY_BLOCK_SIZE], chip8_memory_block(&chip8->memory, block), CHIP8_MEMORY_BLOCK_SIZE);
+}
+
+// Memory pages are shared with the state rather than copied, so the state
+// must outlive the machine or the next restore/load on it
+void chip8_state_restore(struct chip8* chip8, const struct chip8_state* state)
+{
+    chip8_load_image(chip8, &state->image);
+    chip8_state_restore_registers(chip8, state);
+
+    memcpy(chip8->screen.rows, state->screen, sizeof(chip8->screen.rows));
+    chip8->screen.dirty = 0xffffffff;
+    chip8->screen.changed = 0xffffffff;
+}
+
+// Only bytes that actually differ are written, so the decoded and translated
+// code of a block that was written back to the same value survives
+void chip8_state_restore_block(struct chip8* chip8, const struct chip8_state* state, int block)
+{
+    const unsigned char* saved = &state->image.memory[block * CHIP8_MEMORY_BLOCK_SIZE];
+    if(memcmp(saved, chip8_memory_block(&chip8->memory, block), CHIP8_MEMORY_BLOCK_SIZE) == 0)
+        return;
+
+    int i;
+    for(i = 0; i < CHIP8_MEMORY_BLOCK_SIZE; i++)
+    {
+        int index = block * CHIP8_MEMORY_BLOCK_SIZE + i;
+        if(chip8_memory_get(&chip8->memory, index) != saved[i])
+            chip8_memory_write(chip8, index, saved[i]);
+    }
+}
+
+// Like chip8_state_restore, but memory is written into the machine's own
+// pages, so state may be reused or freed as soon as this returns
+void chip8_state_restore_private(struct chip8* chip8, const struct chip8_state* state)
+{
+    int block;
+    for(block = 0; block < CHIP8_MEMORY_TOTAL_BLOCKS; block++)
+        chip8_state_restore_block(chip8, state, block);
+    chip8_state_restore_registers(chip8, state);
+
+    memcpy(chip8->screen.rows, state->screen, sizeof(chip8->screen.rows));
+    chip8->screen.dirty = 0xffffffff;
+    chip8->screen.changed = 0xffffffff;
+}
+
+bool chip8_state_save(const struct chip8* chip8, const char* filename)
+{
+    struct chip8_state* state = malloc(sizeof(struct chip8_state));
+    if(!state)
+        return false;
+    chip8_state_capture(chip8, state);
+
+    FILE* f = fopen(filename, "wb");
+    bool saved = f && fwrite(state, sizeof(struct chip8_state), 1, f) == 1;
+    if(f && fclose(f) != 0)
+        saved = false;
+
+    free(state);
+    return saved;
+}
+
+static bool chip8_state_is_valid(const struct chip8_state* state)
+{
+    return memcmp(state->magic, CHIP8_STATE_MAGIC, sizeof(state->magic)) == 0 &&
+        state->version == CHIP8_STATE_VERSION &&
+        state->size == sizeof(struct chip8_state) &&
+        // The same bound chip8_stack asserts on
+        state->SP < CHIP8_TOTAL_STACK_DEPTH &&
+        state->PC < CHIP8_MEMORY_SIZE &&
+        // chip8_run never ends a frame that is already past its length
+        state->cycles_per_frame > 0 &&
+        state->frame_cycles < state->cycles_per_frame &&
+        state->waiting <= 1;
+}
+
+// Maps the file read-only, any number of machines can then be restored from
+// it and share its memory until they write. Returns NULL when the file cannot
+// be read or is not a state of this version
+const struct chip8_state* chip8_state_map(const char* filename)
+{
+    struct chip8_state* state = NULL;
+#ifdef _WIN32
+    FILE* f = fopen(filename, "rb");
+    if(!f)
+        return NULL;
+
+    state = malloc(sizeof(struct chip8_state));
+    if(!state || fread(state, sizeof(struct chip8_state), 1, f) != 1)
+    {
+        free(state);
+        state = NULL;
+    }
+    fclose(f);
+#else
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct chip8_state))
+    {
+        state = mmap(0, sizeof(struct chip8_state), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(state == MAP_FAILED)
+            state = NULL;
+    }
+    close(fd);
+#endif
+
+    if(state && !chip8_state_is_valid(state))
+    {
+        chip8_state_unmap(state);
+        return NULL;
+    }
+
+    return state;
+}
+
+void chip8_state_unmap(const struct chip8_state* state)
+{
+#ifdef _WIN32
+    free((void*)state);
+#else
+    munmap((void*)state, sizeof(struct chip8_state));
+#endif
+}
@@ -0,0 +1,172 @@
+#include "chip8_telemetry.h"
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define CHIP8_TELEMETRY_UNIX_PREFIX "unix:"
+
+void chip8_telemetry_init(struct chip8_telemetry* telemetry)
+{
+    atomic_init(&telemetry->instructions, 0);
+    atomic_init(&telemetry->frames, 0);
+    atomic_init(&telemetry->draws, 0);
+    atomic_init(&telemetry->collisions, 0);
+    atomic_init(&telemetry->key_waits, 0);
+    atomic_init(&telemetry->timer_ticks, 0);
+}
+
+static unsigned long long chip8_telemetry_read(const atomic_ullong* counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Writes one JSON line for the counters as they are now, seconds being the
+// time since reporting started and instructions_per_second the rate since
+// the sample before. Counters are read one by one, so a line may mix values
+// a few instructions apart
+int chip8_telemetry_format(const struct chip8_telemetry* telemetry, double seconds, double instructions_per_second, char* buf, int size)
+{
+    return snprintf(buf, size,
+                    "{\"seconds\":%.3f,\"instructions\":%llu,\"instructions_per_second\":%.0f,\"frames\":%llu,\"draws\":%llu,"
+                    "\"collisions\":%llu,\"key_waits\":%llu,\"timer_ticks\":%llu}\n",
+                    seconds,
+                    chip8_telemetry_read(&telemetry->instructions),
+                    instructions_per_second,
+                    chip8_telemetry_read(&telemetry->frames),
+                    chip8_telemetry_read(&telemetry->draws),
+                    chip8_telemetry_read(&telemetry->collisions),
+                    chip8_telemetry_read(&telemetry->key_waits),
+                    chip8_telemetry_read(&telemetry->timer_ticks));
+}
+
+static double chip8_telemetry_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1.0e-9*now.tv_nsec;
+}
+
+// A listener that went away only costs us the samples, never a SIGPIPE
+static void chip8_telemetry_write(struct chip8_telemetry_reporter* reporter, const char* line, int length)
+{
+    if(reporter->file)
+    {
+        fwrite(line, 1, length, reporter->file);
+        fflush(reporter->file);
+        return;
+    }
+
+#ifndef _WIN32
+    if(reporter->socket != -1 && send(reporter->socket, line, length, MSG_NOSIGNAL) != length)
+    {
+        close(reporter->socket);
+        reporter->socket = -1;
+    }
+#endif
+}
+
+static void* chip8_telemetry_reporter_thread(void* vargp)
+{
+    struct chip8_telemetry_reporter* reporter = (struct chip8_telemetry_reporter*)vargp;
+    struct timespec interval = { reporter->interval_ms / 1000, (reporter->interval_ms % 1000) * 1000000L };
+    double start = chip8_telemetry_now();
+    double last = start;
+    unsigned long long last_instructions = chip8_telemetry_read(&reporter->telemetry->instructions);
+    char line[320];
+
+    bool running;
+    do
+    {
+        nanosleep(&interval, NULL);
+
+        // Sampled after the flag so the last line has the final totals
+        running = atomic_load(&reporter->running);
+        double now = chip8_telemetry_now();
+        unsigned long long instructions = chip8_telemetry_read(&reporter->telemetry->instructions);
+        double rate = now > last ? (instructions - last_instructions) / (now - last) : 0.0;
+        last = now;
+        last_instructions = instructions;
+
+        int length = chip8_telemetry_format(reporter->telemetry, now - start, rate, line, sizeof(line));
+        chip8_telemetry_write(reporter, line, length);
+    }
+    while(running);
+
+    return NULL;
+}
+
+static void chip8_telemetry_reporter_close(struct chip8_telemetry_reporter* reporter)
+{
+    if(reporter->file && reporter->file != stdout)
+        fclose(reporter->file);
+    reporter->file = NULL;
+
+#ifndef _WIN32
+    if(reporter->socket != -1)
+        close(reporter->socket);
+#endif
+    reporter->socket = -1;
+}
+
+// target is a file to append to, "-" for stdout or unix:path for a stream
+// socket someone is listening on. Returns false when it cannot be opened
+bool chip8_telemetry_reporter_start(struct chip8_telemetry_reporter* reporter, const struct chip8_telemetry* telemetry, const char* target, unsigned int interval_ms)
+{
+    reporter->telemetry = telemetry;
+    reporter->interval_ms = interval_ms;
+    reporter->file = NULL;
+    reporter->socket = -1;
+
+    size_t prefix = strlen(CHIP8_TELEMETRY_UNIX_PREFIX);
+    if(strncmp(target, CHIP8_TELEMETRY_UNIX_PREFIX, prefix) == 0)
+    {
+#ifdef _WIN32
+        return false;
+#else
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if(strlen(target + prefix) >= sizeof(address.sun_path))
+            return false;
+        strcpy(address.sun_path, target + prefix);
+
+        reporter->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(reporter->socket == -1)
+            return false;
+        if(connect(reporter->socket, (struct sockaddr*)&address, sizeof(address)) != 0)
+        {
+            close(reporter->socket);
+            reporter->socket = -1;
+            return false;
+        }
+#endif
+    }
+    else if(strcmp(target, "-") == 0)
+        reporter->file = stdout;
+    else
+    {
+        reporter->file = fopen(target, "a");
+        if(!reporter->file)
+            return false;
+    }
+
+    atomic_init(&reporter->running, true);
+    if(pthread_create(&reporter->thread, NULL, chip8_telemetry_reporter_thread, reporter) != 0)
+    {
+        chip8_telemetry_reporter_close(reporter);
+        return false;
+    }
+    return true;
+}
+
+// Returns once the final sample has been written
+void chip8_telemetry_reporter_stop(struct chip8_telemetry_reporter* reporter)
+{
+    atomic_store(&reporter->running, false);
+    pthread_join(reporter->thread, NULL);
+    chip8_telemetry_reporter_close(reporter);
+}
@@ -0,0 +1,222 @@
+#include "chip8_threaded.h"
+#include "chip8.h"
+
+// GCC and clang support labels as values, which lets every instruction
+// jump straight to the next one instead of returning to a central switch
+#if defined(__GNUC__)
+#define CHIP8_THREADED_COMPUTED_GOTO
+#endif
+
+#ifdef CHIP8_THREADED_COMPUTED_GOTO
+#define CHIP8_OP(op) label_##op
+#define CHIP8_NEXT goto dispatch
+#else
+#define CHIP8_OP(op) case op
+#define CHIP8_NEXT break
+#endif
+
+unsigned int chip8_threaded_exec(struct chip8* chip8, unsigned int cycles)
+{
+#ifdef CHIP8_THREADED_COMPUTED_GOTO
+    static void* const labels[CHIP8_TOTAL_OPS] = {
+        [CHIP8_OP_NOP] = &&label_CHIP8_OP_NOP,
+        [CHIP8_OP_CLS] = &&label_CHIP8_OP_CLS,
+        [CHIP8_OP_RET] = &&label_CHIP8_OP_RET,
+        [CHIP8_OP_JP] = &&label_CHIP8_OP_JP,
+        [CHIP8_OP_CALL] = &&label_CHIP8_OP_CALL,
+        [CHIP8_OP_SE_BYTE] = &&label_CHIP8_OP_SE_BYTE,
+        [CHIP8_OP_SNE_BYTE] = &&label_CHIP8_OP_SNE_BYTE,
+        [CHIP8_OP_SE_REG] = &&label_CHIP8_OP_SE_REG,
+        [CHIP8_OP_LD_BYTE] = &&label_CHIP8_OP_LD_BYTE,
+        [CHIP8_OP_ADD_BYTE] = &&label_CHIP8_OP_ADD_BYTE,
+        [CHIP8_OP_LD_REG] = &&label_CHIP8_OP_LD_REG,
+        [CHIP8_OP_OR] = &&label_CHIP8_OP_OR,
+        [CHIP8_OP_AND] = &&label_CHIP8_OP_AND,
+        [CHIP8_OP_XOR] = &&label_CHIP8_OP_XOR,
+        [CHIP8_OP_ADD_REG] = &&label_CHIP8_OP_ADD_REG,
+        [CHIP8_OP_SUB] = &&label_CHIP8_OP_SUB,
+        [CHIP8_OP_SHR] = &&label_CHIP8_OP_SHR,
+        [CHIP8_OP_SUBN] = &&label_CHIP8_OP_SUBN,
+        [CHIP8_OP_SHL] = &&label_CHIP8_OP_SHL,
+        [CHIP8_OP_SNE_REG] = &&label_CHIP8_OP_SNE_REG,
+        [CHIP8_OP_LD_I] = &&label_CHIP8_OP_LD_I,
+        [CHIP8_OP_JP_V0] = &&label_CHIP8_OP_JP_V0,
+        [CHIP8_OP_RND] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_DRW] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_SKP] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_SKNP] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_LD_VX_DT] = &&label_CHIP8_OP_LD_VX_DT,
+        [CHIP8_OP_LD_VX_K] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_LD_DT_VX] = &&label_CHIP8_OP_LD_DT_VX,
+        [CHIP8_OP_LD_ST_VX] = &&label_CHIP8_OP_LD_ST_VX,
+        [CHIP8_OP_ADD_I_VX] = &&label_CHIP8_OP_ADD_I_VX,
+        [CHIP8_OP_LD_F_VX] = &&label_CHIP8_OP_LD_F_VX,
+        [CHIP8_OP_LD_B_VX] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_LD_MEM_VX] = &&label_CHIP8_OP_HANDLER,
+        [CHIP8_OP_LD_VX_MEM] = &&label_CHIP8_OP_HANDLER
+    };
+#endif
+
+    struct chip8_registers* registers = &chip8->registers;
+    unsigned char* V = registers->V;
+    const struct chip8_instruction* ins;
+    unsigned int executed = 0;
+
+#ifdef CHIP8_THREADED_COMPUTED_GOTO
+dispatch:
+#else
+    for(;;)
+    {
+#endif
+        if(executed == cycles)
+            return executed;
+
+        // The cache mapping ends at CHIP8_MEMORY_SIZE, wrap before looking
+        ins = &chip8->instructions.instructions[registers->PC % CHIP8_MEMORY_SIZE];
+        if(registers->PC >= CHIP8_MEMORY_SIZE || !ins->handler)
+            ins = chip8_fetch(chip8, registers->PC);
+
+        registers->PC += 2;
+        executed++;
+
+#ifdef CHIP8_THREADED_COMPUTED_GOTO
+        goto *labels[ins->op];
+#else
+        switch(ins->op)
+        {
+#endif
+            CHIP8_OP(CHIP8_OP_NOP):
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_CLS):
+                chip8_screen_clear(&chip8->screen);
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_RET):
+                registers->PC = chip8_stack_pop(chip8);
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_JP):
+                registers->PC = ins->nnn;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_CALL):
+                chip8_stack_push(chip8, registers->PC);
+                registers->PC = ins->nnn;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SE_BYTE):
+                if(V[ins->x] == ins->kk)
+                    registers->PC += 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SNE_BYTE):
+                if(V[ins->x] != ins->kk)
+                    registers->PC += 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SE_REG):
+                if(V[ins->x] == V[ins->y])
+                    registers->PC += 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_BYTE):
+                V[ins->x] = ins->kk;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_ADD_BYTE):
+                V[ins->x] += ins->kk;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_REG):
+                V[ins->x] = V[ins->y];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_OR):
+                V[ins->x] |= V[ins->y];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_AND):
+                V[ins->x] &= V[ins->y];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_XOR):
+                V[ins->x] ^= V[ins->y];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_ADD_REG):
+            {
+                unsigned short tmp = V[ins->x] + V[ins->y];
+                V[0x0f] = (tmp > 0xFF);
+                V[ins->x] = tmp;
+            }
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SUB):
+                V[0x0f] = (V[ins->x] > V[ins->y]);
+                V[ins->x] = V[ins->x] - V[ins->y];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SHR):
+                V[0x0f] = V[ins->x] & 0x01;
+                V[ins->x] = V[ins->x] / 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SUBN):
+                V[0x0f] = V[ins->y] > V[ins->x];
+                V[ins->x] = V[ins->y] - V[ins->x];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SHL):
+                V[0x0f] = V[ins->x] & 0b10000000;
+                V[ins->x] = V[ins->x] * 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_SNE_REG):
+                if(V[ins->x] != V[ins->y])
+                    registers->PC += 2;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_I):
+                registers->I = ins->nnn;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_JP_V0):
+                registers->PC = ins->nnn + V[0x00];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_VX_DT):
+                V[ins->x] = registers->delay_timer;
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_DT_VX):
+                registers->delay_timer = V[ins->x];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_ST_VX):
+                registers->sound_timer = V[ins->x];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_ADD_I_VX):
+                registers->I += V[ins->x];
+                CHIP8_NEXT;
+
+            CHIP8_OP(CHIP8_OP_LD_F_VX):
+                registers->I = V[ins->x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
+                CHIP8_NEXT;
+
+#ifdef CHIP8_THREADED_COMPUTED_GOTO
+            // Memory, screen, keyboard and random instructions share the interpreter's handlers
+            label_CHIP8_OP_HANDLER:
+#else
+            default:
+#endif
+                ins->handler(chip8, ins);
+                if(chip8->key_wait)
+                    return executed;
+                CHIP8_NEXT;
+#ifndef CHIP8_THREADED_COMPUTED_GOTO
+        }
+    }
+#endif
+}
@@ -1,16 +1,39 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
 #include <windows.h>
 #include "SDL2/SDL.h"
 #include "chip8.h"
+#include "chip8_framebuffer.h"
+#include "chip8_pacer.h"
+#include "chip8_rewind.h"
+#include "chip8_movie.h"
+#include "chip8_telemetry.h"
 #include <math.h>
 #include <time.h>
 #include <pthread.h> 
 
-const char keyboard_map[CHIP8_TOTAL_KEYS] = {
+const int keyboard_map[CHIP8_TOTAL_KEYS] = {
     SDLK_0, SDLK_1, SDLK_2, SDLK_3, SDLK_4, SDLK_5,
     SDLK_6, SDLK_7, SDLK_8, SDLK_9, SDLK_a, SDLK_b,
     SDLK_c, SDLK_d, SDLK_e, SDLK_f};
 
+// Extra bindings so the numeric keypad also drives keys 0-9
+const int keypad_map[10] = {
+    SDLK_KP_0, SDLK_KP_1, SDLK_KP_2, SDLK_KP_3, SDLK_KP_4,
+    SDLK_KP_5, SDLK_KP_6, SDLK_KP_7, SDLK_KP_8, SDLK_KP_9};
+
+// Looks up the key code first, then the layout-independent scancode, which
+// can be bound with SDL_SCANCODE_TO_KEYCODE
+int map_key(struct chip8_keyboard* keyboard, const SDL_Keysym* keysym)
+{
+    int vkey = chip8_keyboard_map(keyboard, keysym->sym);
+    if(vkey == -1)
+        vkey = chip8_keyboard_map(keyboard, SDL_SCANCODE_TO_KEYCODE(keysym->scancode));
+
+    return vkey;
+}
+
 
 
 void cls(HANDLE hConsole)
@@ -58,69 +81,116 @@ void cls(HANDLE hConsole)
     SetConsoleCursorPosition(hConsole, coordScreen);
 }
 
-void *run_thread(void *vargp)
-{
+pthread_mutex_t key_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t key_cond = PTHREAD_COND_INITIALIZER;
 
-	struct chip8 *chip8 = (struct chip8*)vargp;
-	HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-	cls(hConsole);
+// Completed frames handed from run_thread to the render loop
+struct chip8_framebuffer framebuffer;
 
-	double deltaTime = 0;
-	double frame = 0;
-	double cpu_clk = 0;
-	double cpu = 0;
+// Turbo runs frames back to back with no wall-clock pacing; the timers still
+// tick once per emulated frame
+bool turbo = false;
 
-	int iii = 0;
-	double speed = 5e-4;
+// Held by the render loop while Backspace is down: run_thread then steps
+// back one recorded frame per frame instead of running
+atomic_bool rewinding = false;
 
-	struct timespec tstart = { 0,0 }, tend = { 0,0 };
-	while (1) {
+// Cleared on quit so run_thread stops before the machine and its movie go away
+atomic_bool running = true;
 
-		clock_gettime(CLOCK_MONOTONIC, &tend);
-		deltaTime = ((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - ((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec);
-		clock_gettime(CLOCK_MONOTONIC, &tstart);
+// Sound timer as of the last frame, stored by run_thread once per frame for
+// the audio callback, which runs on SDL's thread and must not read the machine
+atomic_uchar sound_timer = 0;
 
-        frame += deltaTime;
-		cpu += deltaTime;
-		cpu_clk += deltaTime;
+// Keys the host really holds, bit n is CHIP-8 key n; a rewind restores the
+// keypad of an older frame and is synced back to this
+atomic_ushort host_keys = 0;
 
-        if(cpu >= speed){
+void *run_thread(void *vargp)
+{
+
+	struct chip8 *chip8 = (struct chip8*)vargp;
 
-            if(chip8->registers.delay_timer > 0)
-                chip8->registers.delay_timer--;
-            else{
-                unsigned short opcode = chip8_memory_get_short(&chip8->memory, chip8->registers.PC);
-                chip8->registers.PC += 2;
-                chip8_exec(chip8, opcode);
+	// Run each frame in a burst, then sleep until the next 60 Hz deadline
+	struct chip8_pacer pacer;
+	chip8_pacer_init(&pacer, CHIP8_FRAMES_PER_SECOND);
+
+	struct chip8_rewind* rewind = malloc(sizeof(struct chip8_rewind));
+	chip8_rewind_init(rewind);
+	// Turbo runs many frames per 1/60 s: record one of them per wall-clock
+	// frame so the history costs no throughput and rewinds at real speed
+	struct chip8_pacer recorder;
+	chip8_pacer_init(&recorder, CHIP8_FRAMES_PER_SECOND);
+	unsigned int turbo_frames = 0;
+	while (atomic_load(&running)) {
+
+        // One emulated frame: the instruction budget plus one tick of the 60 Hz timers,
+        // recorded first so rewinding lands on the frame before
+        enum chip8_run_result result = CHIP8_RUN_FRAME;
+        if(atomic_load(&rewinding)){
+            // A recording keeps the input of the timeline it continues on
+            if(chip8_rewind_back(rewind, chip8)){
+                chip8_keyboard_sync(&chip8->keyboard, atomic_load(&host_keys));
+                if(chip8->movie)
+                    chip8_movie_truncate(chip8->movie, chip8->cycles);
             }
-            cpu = 0;
+        }
+        else{
+            // Reading the clock every frame alone would cost turbo a quarter of its speed
+            if(!turbo || (++turbo_frames % CHIP8_REWIND_TURBO_CHECK_FRAMES == 0 && chip8_pacer_is_due(&recorder)))
+                chip8_rewind_push(rewind, chip8);
+            result = chip8_run(chip8, chip8->cycles_per_frame);
+        }
+        chip8_framebuffer_publish(&framebuffer, &chip8->screen);
+        atomic_store(&sound_timer, chip8->registers.sound_timer);
+
+        // Waiting on Fx0A with both timers stopped, nothing changes until a key arrives
+        if(result == CHIP8_RUN_KEY_WAIT && !chip8->registers.delay_timer && !chip8->registers.sound_timer){
+            pthread_mutex_lock(&key_mutex);
+            while(chip8_keyboard_is_waiting(&chip8->keyboard) && !atomic_load(&rewinding) && atomic_load(&running))
+                pthread_cond_wait(&key_cond, &key_mutex);
+            pthread_mutex_unlock(&key_mutex);
+            chip8_pacer_reset(&pacer);
         }
 
-        if (frame >= 0.1) {
-            COORD pos = {0, 0};
-            SetConsoleCursorPosition(hConsole, pos);
-
+        if(!turbo || atomic_load(&rewinding))
+            chip8_pacer_wait(&pacer);
+    }
 
-            int i = 0;
-            for(i = 0; i < 12; i++)            
-                printf(" V%02d|", i);
-            printf("\n");
+    free(rewind);
+    return NULL;
+}
 
-            for(i = 0; i < 12; i++)            
-                printf(" %02x |", chip8->registers.V[i]);
 
-            printf("\n\n");
+// Expands the dirty rows of the 1bpp screen into the 64x32 streaming texture,
+// which SDL_RenderCopy then scales up to the window
+void draw_screen(SDL_Texture* texture, struct chip8_screen* screen, unsigned int dirty)
+{
+    int first = 0, last = CHIP8_HEIGHT - 1;
+    while(!(dirty & (1u << first)))
+        first++;
+    while(!(dirty & (1u << last)))
+        last--;
+
+    SDL_Rect rect = { 0, first, CHIP8_WIDTH, last - first + 1 };
+    void* pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0)
+        return;
 
-            printf("  I   | dt | st |  PC  | SP |\n");
-            printf(" %04x |", chip8->registers.I);
-            printf(" %02x |", chip8->registers.delay_timer);
-            printf(" %02x |", chip8->registers.sound_timer);
-            printf(" %04x |", chip8->registers.PC);
-            printf(" %02x |", chip8->registers.SP);
-            frame = 0;
-    
+    int x, y;
+    for(y = first; y <= last; y++)
+    {
+        Uint32* line = (Uint32*)((Uint8*)pixels + (y - first) * pitch);
+        unsigned long long row = screen->rows[y];
+        for(x = 0; x < CHIP8_WIDTH; x++)
+        {
+            Uint32 lit = (row >> (CHIP8_WIDTH - 1 - x)) & 1;
+            line[x] = 0xFF000000 | (0x00FFFFFF & -lit);
         }
     }
+
+    SDL_UnlockTexture(texture);
 }
 
 
@@ -128,16 +198,42 @@ const double FREQ = 441.0f;
 const int AMPLITUDE = 15000;
 const int SAMPLE_RATE = 44100;
 
+// One period of the 441 Hz tone at 44100 Hz, built once at startup
+#define WAVETABLE_SIZE 100
+Sint16 wavetable[WAVETABLE_SIZE];
+
+struct audio_state
+{
+    int phase;
+};
+
+void audio_build_wavetable()
+{
+    int i;
+    for(i = 0; i < WAVETABLE_SIZE; i++)
+        wavetable[i] = (Sint16)(AMPLITUDE * sin(2.0 * M_PI * FREQ * i / SAMPLE_RATE));
+}
+
 void audio_callback(void *user_data, Uint8 *raw_buffer, int bytes)
 {
     Sint16 *buffer = (Sint16*)raw_buffer;
     int length = bytes / 2; // 2 bytes per sample for AUDIO_S16SYS
-    int *sample_nr = (int*)user_data;
+    struct audio_state *audio = (struct audio_state*)user_data;
+
+    // The device always runs; the sound timer, counted down in emulated time
+    // by the core, gates the tone for the whole buffer
+    if(!atomic_load(&sound_timer))
+    {
+        memset(buffer, 0, length * sizeof(Sint16));
+        return;
+    }
+
     int i;
-    for(i = 0; i < length; i++, (*sample_nr)++)
+    for(i = 0; i < length; i++)
     {
-        double time = (double)(*sample_nr) / (double)SAMPLE_RATE;
-        buffer[i] = (Sint16)(AMPLITUDE * sin(2.0f * M_PI * FREQ * time)); // render 441 HZ sine wave
+        buffer[i] = wavetable[audio->phase];
+        if(++audio->phase == WAVETABLE_SIZE)
+            audio->phase = 0;
     }
 }
 
@@ -176,9 +272,61 @@ int main(int argc, char** argv)
     }
 
     struct chip8 chip8;
-    chip8_init(&chip8);
-    chip8_load(&chip8, buf, size);
+    if(!chip8_init(&chip8))
+    {
+        printf("Failed to initialize the machine");
+        return -1;
+    }
+    if(!chip8_load(&chip8, buf, size))
+    {
+        printf("Failed to load the program");
+        return -1;
+    }
     chip8_keyboard_set_map(&chip8.keyboard, keyboard_map);
+    int i;
+    for(i = 0; i < 10; i++)
+        chip8_keyboard_bind(&chip8.keyboard, keypad_map[i], i);
+    chip8_random_seed(&chip8.random, time(NULL));
+
+    const char* record = NULL;
+    const char* telemetry_target = NULL;
+    int arg;
+    for(arg = 2; arg < argc; arg++)
+    {
+        if(strcmp(argv[arg], "threaded") == 0)
+            chip8_set_engine(&chip8, CHIP8_ENGINE_THREADED);
+
+        if(strcmp(argv[arg], "jit") == 0 && !chip8_set_engine(&chip8, CHIP8_ENGINE_JIT))
+            printf("JIT is not available, using the interpreter\n");
+
+        if(strcmp(argv[arg], "turbo") == 0)
+            turbo = true;
+
+        // record <file>: write the session's input as a movie on exit
+        if(strcmp(argv[arg], "record") == 0 && arg + 1 < argc)
+            record = argv[++arg];
+
+        // telemetry <file|-|unix:path>: counters as JSON lines, 10 per second
+        if(strcmp(argv[arg], "telemetry") == 0 && arg + 1 < argc)
+            telemetry_target = argv[++arg];
+    }
+
+    struct chip8_telemetry telemetry;
+    chip8_telemetry_init(&telemetry);
+    chip8.telemetry = &telemetry;
+
+    struct chip8_telemetry_reporter reporter;
+    if(telemetry_target && !chip8_telemetry_reporter_start(&reporter, &telemetry, telemetry_target, 100)){
+        printf("Failed to open telemetry %s\n", telemetry_target);
+        telemetry_target = NULL;
+    }
+
+    struct chip8_movie movie;
+    chip8_movie_init(&movie);
+    if(record){
+        chip8_movie_begin(&movie, &chip8);
+        chip8.movie = &movie;
+    }
 
     
 
@@ -194,31 +342,46 @@ int main(int argc, char** argv)
 
     if(SDL_Init(SDL_INIT_AUDIO) != 0) SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
 
-    int sample_nr = 0;
+    audio_build_wavetable();
+    struct audio_state audio = { 0 };
 
     SDL_AudioSpec want;
     want.freq = SAMPLE_RATE; // number of samples per second
     want.format = AUDIO_S16SYS; // sample type (here: signed short i.e. 16 bit)
     want.channels = 1; // only one channel
-    want.samples = 2048; // buffer-size
+    want.samples = 512; // buffer-size, also how often the sound timer is sampled
     want.callback = audio_callback; // function SDL calls periodically to refill the buffer
-    want.userdata = &sample_nr; // counter, keeping track of current sample number
+    want.userdata = &audio; // tone phase
 
     SDL_AudioSpec have;
     if(SDL_OpenAudio(&want, &have) != 0) SDL_LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to open audio: %s", SDL_GetError());
     if(want.format != have.format) SDL_LogError(SDL_LOG_CATEGORY_AUDIO, "Failed to get the desired AudioSpec");
+    SDL_PauseAudio(0);
     
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_TEXTUREACCESS_TARGET);
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, CHIP8_WIDTH, CHIP8_HEIGHT);
 
 
+    chip8_framebuffer_init(&framebuffer);
+
 	pthread_t tid;
 	pthread_create(&tid, NULL, run_thread, (void *)&chip8);
 
+    // The texture starts out undefined, so the first frame uploads every row
+    unsigned int dirty = ~0u;
+
+    // Turbo has no fixed speed, so the title shows the measured one once a second
+    unsigned long long title_instructions = 0;
+    struct timespec title_last;
+    clock_gettime(CLOCK_MONOTONIC, &title_last);
+
 
     while(1){
 
   
+        // Block until input arrives or the next frame is due instead of spinning
         SDL_Event event;
+        SDL_WaitEventTimeout(NULL, 1000 / CHIP8_FRAMES_PER_SECOND);
         while(SDL_PollEvent(&event)){
 
             switch(event.type){
@@ -228,66 +391,99 @@ int main(int argc, char** argv)
                     goto out;
                 break;
 
+                case SDL_WINDOWEVENT:
+                    if(event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                        dirty = ~0u;
+                break;
+
                 case SDL_KEYDOWN:{
-                    char key = event.key.keysym.sym;
-                    int vkey = chip8_keyboard_map(&chip8.keyboard, key);
-                    if(vkey != -1)
+                    if(event.key.keysym.sym == SDLK_BACKSPACE){
+                        pthread_mutex_lock(&key_mutex);
+                        atomic_store(&rewinding, true);
+                        pthread_cond_signal(&key_cond);
+                        pthread_mutex_unlock(&key_mutex);
+                        break;
+                    }
+
+                    int vkey = map_key(&chip8.keyboard, &event.key.keysym);
+                    if(vkey != -1){
+                        pthread_mutex_lock(&key_mutex);
+                        atomic_fetch_or(&host_keys, 1 << vkey);
                         chip8_keyboard_down(&chip8.keyboard, vkey);
+                        pthread_cond_signal(&key_cond);
+                        pthread_mutex_unlock(&key_mutex);
+                    }
                 }
                 break;
 
                 case SDL_KEYUP:{
-                    char key = event.key.keysym.sym;
-                    int vkey = chip8_keyboard_map(&chip8.keyboard, key);
-                    if(vkey != -1)
+                    if(event.key.keysym.sym == SDLK_BACKSPACE){
+                        atomic_store(&rewinding, false);
+                        break;
+                    }
+
+                    int vkey = map_key(&chip8.keyboard, &event.key.keysym);
+                    if(vkey != -1){
+                        atomic_fetch_and(&host_keys, ~(1 << vkey));
                         chip8_keyboard_up(&chip8.keyboard, vkey);
+                    }
                 }
                 break;                
             }
         }
 
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
+        struct chip8_screen* screen = chip8_framebuffer_acquire(&framebuffer);
+        dirty |= chip8_screen_fetch_dirty(screen);
+        if(dirty){
+            draw_screen(texture, screen, dirty);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            dirty = 0;
+        }
 
-        int x, y;
-        for(x = 0; x < CHIP8_WIDTH; x++)
-        {
-            for(y = 0; y < CHIP8_HEIGHT; y++)
-            {
-
-                if(chip8_screen_is_set(&chip8.screen, x, y))
-                {
-                    SDL_Rect r;
-                    r.x = x * CHIP8_WINDOW_MULTIPLIER;
-                    r.y = y * CHIP8_WINDOW_MULTIPLIER;
-                    r.w = CHIP8_WINDOW_MULTIPLIER;
-                    r.h = CHIP8_WINDOW_MULTIPLIER;
-                    SDL_RenderFillRect(renderer, &r);
-                }
+        if(turbo){
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double elapsed = ((double)now.tv_sec + 1.0e-9*now.tv_nsec) - ((double)title_last.tv_sec + 1.0e-9*title_last.tv_nsec);
+            if(elapsed >= 1.0){
+                unsigned long long instructions = atomic_load(&telemetry.instructions);
+                char title[128];
+                snprintf(title, sizeof(title), "%s - turbo %llu instructions/s", EMULATOR_WINDOW_TITLE,
+                         (unsigned long long)((instructions - title_instructions) / elapsed));
+                SDL_SetWindowTitle(window, title);
+                title_instructions = instructions;
+                title_last = now;
             }
         }
 
-        SDL_RenderPresent(renderer);
-
         /*
         if(chip8.registers.delay_timer > 0){
             Sleep(1);
             chip8.registers.delay_timer--;
         }
         */
-        if(chip8.registers.sound_timer > 0){
-            SDL_PauseAudio(0); // start playing sound
-            SDL_Delay(chip8.registers.sound_timer*10); // wait while sound is playing
-            SDL_PauseAudio(1); // stop playing sound
-            chip8.registers.sound_timer = 0;
-        }
 
   
     }
 
 out:
+    pthread_mutex_lock(&key_mutex);
+    atomic_store(&running, false);
+    pthread_cond_signal(&key_cond);
+    pthread_mutex_unlock(&key_mutex);
+    pthread_join(tid, NULL);
+
+    if(telemetry_target)
+        chip8_telemetry_reporter_stop(&reporter);
+
+    if(record && !chip8_movie_save(&movie, record))
+        printf("Failed to save movie %s\n", record);
+    chip8_movie_destroy(&movie);
+
     SDL_CloseAudio();
+    chip8_destroy(&chip8);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     return 0;
 } 
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "chip8.h"
+
+// Runs many ROMs headless across all cores and prints one line per ROM, in the
+// order they were given, so nightly runs can be diffed
+
+#define BATCH_MAX_THREADS 256
+
+struct batch_job
+{
+    const char* filename;
+    bool loaded;
+    // The requested engine could not be selected and the interpreter ran it
+    bool fallback;
+    unsigned long long frames;
+    unsigned long long cycles;
+    unsigned long long hash;
+    double seconds;
+};
+
+// Each worker owns a deque of job indexes: it pops its own work from the
+// bottom and, once empty, steals from the top of the others'
+struct batch_deque
+{
+    pthread_mutex_t lock;
+    int* jobs;
+    int top;
+    int bottom;
+};
+
+struct batch
+{
+    struct batch_job* jobs;
+    int total_jobs;
+    struct batch_deque* deques;
+    int total_workers;
+    unsigned long long frames;
+    enum chip8_engine engine;
+    unsigned long long seed;
+};
+
+struct batch_worker
+{
+    struct batch* batch;
+    int index;
+};
+
+static double batch_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1.0e-9*now.tv_nsec;
+}
+
+static int batch_pop(struct batch_deque* deque)
+{
+    int job = -1;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom > deque->top)
+        job = deque->jobs[--deque->bottom];
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static int batch_steal(struct batch_deque* deque)
+{
+    int job = -1;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom > deque->top)
+        job = deque->jobs[deque->top++];
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static void batch_run_job(struct batch* batch, struct batch_job* job)
+{
+    struct chip8* chip8 = malloc(sizeof(struct chip8));
+    job->loaded = false;
+    if(!chip8)
+        return;
+    if(!chip8_init(chip8))
+    {
+        free(chip8);
+        return;
+    }
+
+    chip8_random_seed(&chip8->random, batch->seed);
+    job->loaded = chip8_load_file(chip8, job->filename);
+    if(job->loaded)
+    {
+        job->fallback = !chip8_set_engine(chip8, batch->engine);
+
+        double start = batch_now();
+        while(chip8->frames < batch->frames)
+            chip8_run(chip8, chip8->cycles_per_frame);
+        job->seconds = batch_now() - start;
+
+        // A run that lost writes to an allocation failure has no valid result
+        job->loaded = !chip8->memory.failed;
+        job->frames = chip8->frames;
+        job->cycles = chip8->cycles;
+        job->hash = chip8_screen_hash(&chip8->screen);
+    }
+
+    chip8_destroy(chip8);
+    free(chip8);
+}
+
+static void* batch_worker_thread(void* vargp)
+{
+    struct batch_worker* worker = (struct batch_worker*)vargp;
+    struct batch* batch = worker->batch;
+
+    while(1)
+    {
+        int job = batch_pop(&batch->deques[worker->index]);
+
+        // Jobs are never added once the pool starts, so one empty sweep means we are done
+        int i;
+        for(i = 1; job == -1 && i < batch->total_workers; i++)
+            job = batch_steal(&batch->deques[(worker->index + i) % batch->total_workers]);
+
+        if(job == -1)
+            break;
+
+        batch_run_job(batch, &batch->jobs[job]);
+    }
+
+    return NULL;
+}
+
+// Directories mix ROMs with their notes (SPACEFIG.DOC), so only names with no
+// extension or a ROM extension are picked up from them
+static bool batch_is_rom_name(const char* name)
+{
+    const char* ext = strrchr(name, '.');
+    return !ext || strcasecmp(ext, ".ch8") == 0 || strcasecmp(ext, ".c8") == 0 || strcasecmp(ext, ".sc8") == 0;
+}
+
+static int batch_compare_names(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Appends path, or the regular files directly inside it, to the job list
+static void batch_add_path(struct batch* batch, const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        batch->jobs = realloc(batch->jobs, (batch->total_jobs + 1) * sizeof(struct batch_job));
+        memset(&batch->jobs[batch->total_jobs], 0, sizeof(struct batch_job));
+        batch->jobs[batch->total_jobs++].filename = strdup(path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if(!dir)
+        return;
+
+    char** names = NULL;
+    int total_names = 0;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(entry->d_name[0] == '.' || !batch_is_rom_name(entry->d_name))
+            continue;
+
+        char* name = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(name, "%s/%s", path, entry->d_name);
+        if(stat(name, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            free(name);
+            continue;
+        }
+
+        names = realloc(names, (total_names + 1) * sizeof(char*));
+        names[total_names++] = name;
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary, sort so results line up night to night
+    qsort(names, total_names, sizeof(char*), batch_compare_names);
+
+    int i;
+    for(i = 0; i < total_names; i++)
+    {
+        batch_add_path(batch, names[i]);
+        free(names[i]);
+    }
+    free(names);
+}
+
+static int batch_default_threads()
+{
+#ifdef _WIN32
+    return pthread_num_processors_np();
+#else
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// Returns false for a name that is not an engine
+static bool batch_parse_engine(const char* name, enum chip8_engine* engine)
+{
+    if(strcmp(name, "interpreter") == 0)
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    else if(strcmp(name, "threaded") == 0)
+        *engine = CHIP8_ENGINE_THREADED;
+    else if(strcmp(name, "jit") == 0)
+        *engine = CHIP8_ENGINE_JIT;
+    else
+        return false;
+    return true;
+}
+
+void usage()
+{
+    printf("usage: chip8_batch [--frames n] [--engine interpreter|threaded|jit] [--seed n] [--threads n] rom|directory...\n");
+}
+
+int main(int argc, char** argv)
+{
+    struct batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.frames = CHIP8_FRAMES_PER_SECOND * 10;
+    batch.engine = CHIP8_ENGINE_INTERPRETER;
+    batch.seed = CHIP8_DEFAULT_RANDOM_SEED;
+    int threads = batch_default_threads();
+
+    int i;
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            batch.frames = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            if(!batch_parse_engine(argv[++i], &batch.engine))
+            {
+                usage();
+                return -1;
+            }
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            batch.seed = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strncmp(argv[i], "--", 2) == 0)
+        {
+            usage();
+            return -1;
+        }
+        else
+            batch_add_path(&batch, argv[i]);
+    }
+
+    if(batch.total_jobs == 0)
+    {
+        usage();
+        return -1;
+    }
+
+    if(threads < 1)
+        threads = 1;
+    if(threads > BATCH_MAX_THREADS)
+        threads = BATCH_MAX_THREADS;
+    if(threads > batch.total_jobs)
+        threads = batch.total_jobs;
+
+    // Deal the jobs out round-robin; stealing evens out whatever imbalance is left
+    batch.total_workers = threads;
+    batch.deques = calloc(threads, sizeof(struct batch_deque));
+    for(i = 0; i < threads; i++)
+    {
+        pthread_mutex_init(&batch.deques[i].lock, NULL);
+        batch.deques[i].jobs = malloc(batch.total_jobs * sizeof(int));
+    }
+    for(i = batch.total_jobs - 1; i >= 0; i--)
+    {
+        struct batch_deque* deque = &batch.deques[i % threads];
+        deque->jobs[deque->bottom++] = i;
+    }
+
+    double start = batch_now();
+
+    pthread_t tids[BATCH_MAX_THREADS];
+    struct batch_worker workers[BATCH_MAX_THREADS];
+    // Workers that fail to start leave their deques to be stolen by the rest;
+    // with none started the jobs run here
+    int started = 0;
+    for(i = 0; i < threads; i++)
+    {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        if(pthread_create(&tids[started], NULL, batch_worker_thread, &workers[i]) == 0)
+            started++;
+    }
+    if(started == 0)
+        batch_worker_thread(&workers[0]);
+    threads = started ? started : 1;
+    for(i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    double elapsed = batch_now() - start;
+
+    unsigned long long total_cycles = 0;
+    int failed = 0;
+    for(i = 0; i < batch.total_jobs; i++)
+    {
+        struct batch_job* job = &batch.jobs[i];
+        if(!job->loaded)
+        {
+            printf("error            %s\n", job->filename);
+            failed++;
+            continue;
+        }
+
+        if(job->fallback)
+            printf("# JIT is not available, %s ran on the interpreter\n", job->filename);
+        printf("%016llx %llu %llu %.6f %s\n", job->hash, job->frames, job->cycles, job->seconds, job->filename);
+        total_cycles += job->cycles;
+    }
+
+    printf("# %d roms, %d failed, %d threads, %.6f s, %.0f instructions/s\n",
+           batch.total_jobs, failed, threads, elapsed, elapsed > 0 ? total_cycles / elapsed : 0.0);
+
+    for(i = 0; i < threads; i++)
+    {
+        pthread_mutex_destroy(&batch.deques[i].lock);
+        free(batch.deques[i].jobs);
+    }
+    free(batch.deques);
+    for(i = 0; i < batch.total_jobs; i++)
+        free((char*)batch.jobs[i].filename);
+    free(batch.jobs);
+
+    return failed ? 1 : 0;
+}
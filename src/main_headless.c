@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "chip8_pacer.h"
+#include "chip8_lockstep.h"
+#include "chip8_state.h"
+#include "chip8_snapshot.h"
+#include "chip8_movie.h"
+#include "chip8_telemetry.h"
+
+// Runs a ROM with no window, audio or input and reports what it did, for
+// regression runs on machines without a display
+
+// Frames --snapshot-check runs ahead before rolling back
+#define HEADLESS_SNAPSHOT_CHECK_AHEAD 3
+
+// Frames between two comparisons of --lockstep-check; extracting all the lanes
+// costs far more than running them
+#define HEADLESS_LOCKSTEP_CHECK_INTERVAL 8
+
+// --lockstep-check: one plain machine per lane, fed the same random keys, so
+// the lockstep copy of the opcode semantics is held to the core's
+struct lockstep_check
+{
+    struct chip8* references[CHIP8_LOCKSTEP_LANES];
+    unsigned short keys[CHIP8_LOCKSTEP_LANES];
+    // Lanes are extracted here to be compared
+    struct chip8* lane;
+    unsigned long long random;
+};
+
+void usage()
+{
+    printf("usage: chip8_headless rom [--frames n] [--engine interpreter|threaded|jit] [--seed n] [--paced] [--lockstep] [--load-state file] [--save-state file] [--record file] [--play file] [--telemetry file|-|unix:path] [--snapshot-check] [--lockstep-check]\n");
+}
+
+// Returns false for a name that is not an engine
+static bool parse_engine(const char* name, enum chip8_engine* engine)
+{
+    if(strcmp(name, "interpreter") == 0)
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    else if(strcmp(name, "threaded") == 0)
+        *engine = CHIP8_ENGINE_THREADED;
+    else if(strcmp(name, "jit") == 0)
+        *engine = CHIP8_ENGINE_JIT;
+    else
+        return false;
+    return true;
+}
+
+// Runs a fresh machine from the ROM with the same seed and engine straight up
+// to chip8's frame and compares the whole state of the two
+static bool matches_straight_run(const struct chip8* chip8, const char* filename, unsigned long long seed, enum chip8_engine engine)
+{
+    struct chip8* reference = malloc(sizeof(struct chip8));
+    struct chip8_state* expected = malloc(sizeof(struct chip8_state));
+    struct chip8_state* actual = malloc(sizeof(struct chip8_state));
+    bool matches = false;
+    if(reference && expected && actual && chip8_init(reference))
+    {
+        chip8_random_seed(&reference->random, seed);
+        if(chip8_load_file(reference, filename))
+        {
+            chip8_set_engine(reference, engine);
+            while(reference->frames < chip8->frames)
+                chip8_run(reference, reference->cycles_per_frame);
+
+            chip8_state_capture(reference, expected);
+            chip8_state_capture(chip8, actual);
+            matches = !reference->memory.failed && memcmp(expected, actual, sizeof(struct chip8_state)) == 0;
+        }
+        chip8_destroy(reference);
+    }
+
+    free(reference);
+    free(expected);
+    free(actual);
+    return matches;
+}
+
+static bool lockstep_check_init(struct lockstep_check* check, const char* filename, unsigned long long seed, enum chip8_engine engine)
+{
+    memset(check, 0, sizeof(struct lockstep_check));
+    check->random = seed;
+
+    check->lane = malloc(sizeof(struct chip8));
+    if(!check->lane || !chip8_init(check->lane))
+        return false;
+
+    int lane;
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        struct chip8* reference = malloc(sizeof(struct chip8));
+        if(!reference)
+            return false;
+        check->references[lane] = reference;
+        if(!chip8_init(reference) || !chip8_load_file(reference, filename))
+            return false;
+
+        chip8_random_seed(&reference->random, seed + lane);
+        chip8_set_engine(reference, engine);
+    }
+    return true;
+}
+
+static void lockstep_check_destroy(struct lockstep_check* check)
+{
+    int lane;
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        if(check->references[lane])
+            chip8_destroy(check->references[lane]);
+        free(check->references[lane]);
+    }
+
+    if(check->lane)
+        chip8_destroy(check->lane);
+    free(check->lane);
+}
+
+// Everything chip8_lockstep_extract carries over
+static bool lockstep_check_matches(const struct chip8* lane, const struct chip8* reference)
+{
+    if(memcmp(lane->registers.V, reference->registers.V, sizeof(lane->registers.V)) != 0 ||
+       lane->registers.I != reference->registers.I ||
+       lane->registers.PC != reference->registers.PC ||
+       lane->registers.SP != reference->registers.SP ||
+       lane->registers.delay_timer != reference->registers.delay_timer ||
+       lane->registers.sound_timer != reference->registers.sound_timer ||
+       memcmp(lane->stack.stack, reference->stack.stack, sizeof(lane->stack.stack)) != 0 ||
+       memcmp(lane->screen.rows, reference->screen.rows, sizeof(lane->screen.rows)) != 0 ||
+       lane->random.state != reference->random.state ||
+       lane->frames != reference->frames ||
+       lane->cycles != reference->cycles)
+        return false;
+
+    int block;
+    for(block = 0; block < CHIP8_MEMORY_TOTAL_BLOCKS; block++)
+    {
+        if(memcmp(chip8_memory_block(&lane->memory, block), chip8_memory_block(&reference->memory, block), CHIP8_MEMORY_BLOCK_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
+
+// Runs one frame on the lanes and on every reference with the same keys held.
+// Every HEADLESS_LOCKSTEP_CHECK_INTERVAL frames and at last_frame, returns the
+// first lane that no longer matches; -1 otherwise
+static int lockstep_check_frame(struct lockstep_check* check, struct chip8_lockstep* lanes, unsigned long long last_frame)
+{
+    int lane;
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        // Now and then hold a new single key or let go, an xorshift per frame and lane
+        check->random ^= check->random << 13;
+        check->random ^= check->random >> 7;
+        check->random ^= check->random << 17;
+        unsigned short keys = check->keys[lane];
+        if(check->random % 8 == 0)
+            keys = (check->random >> 8) % 3 == 0 ? 1 << ((check->random >> 16) % CHIP8_TOTAL_KEYS) : 0;
+
+        struct chip8* reference = check->references[lane];
+        int key;
+        for(key = 0; key < CHIP8_TOTAL_KEYS; key++)
+        {
+            bool held = (check->keys[lane] >> key) & 1;
+            bool holds = (keys >> key) & 1;
+            if(holds && !held)
+                chip8_keyboard_down(&reference->keyboard, key);
+            else if(held && !holds)
+                chip8_keyboard_up(&reference->keyboard, key);
+        }
+        check->keys[lane] = keys;
+        chip8_lockstep_set_keys(lanes, lane, keys);
+    }
+
+    chip8_lockstep_run_frame(lanes);
+
+    for(lane = 0; lane < CHIP8_LOCKSTEP_LANES; lane++)
+    {
+        struct chip8* reference = check->references[lane];
+        unsigned long long frame = reference->frames;
+        while(reference->frames == frame)
+            chip8_run(reference, reference->cycles_per_frame);
+
+        if(lanes->frames % HEADLESS_LOCKSTEP_CHECK_INTERVAL != 0 && lanes->frames < last_frame)
+            continue;
+        chip8_lockstep_extract(lanes, lane, check->lane);
+        if(!lockstep_check_matches(check->lane, reference))
+            return lane;
+    }
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        usage();
+        return -1;
+    }
+
+    const char* filename = argv[1];
+    unsigned long long frames = CHIP8_FRAMES_PER_SECOND * 10;
+    enum chip8_engine engine = CHIP8_ENGINE_INTERPRETER;
+    unsigned long long seed = CHIP8_DEFAULT_RANDOM_SEED;
+    bool paced = false;
+    bool lockstep = false;
+    const char* load_state = NULL;
+    const char* save_state = NULL;
+    const char* record = NULL;
+    const char* play = NULL;
+    const char* telemetry_target = NULL;
+    bool snapshot_check = false;
+    bool lockstep_checked = false;
+
+    int i;
+    for(i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            if(!parse_engine(argv[++i], &engine))
+            {
+                usage();
+                return -1;
+            }
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--paced") == 0)
+            paced = true;
+        else if(strcmp(argv[i], "--lockstep") == 0)
+            lockstep = true;
+        else if(strcmp(argv[i], "--load-state") == 0 && i + 1 < argc)
+            load_state = argv[++i];
+        else if(strcmp(argv[i], "--save-state") == 0 && i + 1 < argc)
+            save_state = argv[++i];
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record = argv[++i];
+        else if(strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+            play = argv[++i];
+        else if(strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+            telemetry_target = argv[++i];
+        else if(strcmp(argv[i], "--snapshot-check") == 0)
+            snapshot_check = true;
+        else if(strcmp(argv[i], "--lockstep-check") == 0)
+            lockstep = lockstep_checked = true;
+        else
+        {
+            usage();
+            return -1;
+        }
+    }
+
+    // Movies start from the freshly loaded ROM and drive a single machine
+    if((record || play) && (load_state || lockstep))
+    {
+        usage();
+        return -1;
+    }
+
+    // The check replays the ROM from scratch on a second machine
+    if(snapshot_check && (record || play || load_state || lockstep))
+    {
+        usage();
+        return -1;
+    }
+    if(lockstep_checked && load_state)
+    {
+        usage();
+        return -1;
+    }
+
+    struct chip8 chip8;
+    if(!chip8_init(&chip8))
+    {
+        printf("Failed to initialize the machine\n");
+        return -1;
+    }
+    chip8_random_seed(&chip8.random, seed);
+    if(!chip8_load_file(&chip8, filename))
+    {
+        printf("Failed to load %s\n", filename);
+        return -1;
+    }
+
+    // A state carries the whole machine, ROM included; --frames still counts
+    // from frame zero, so a run resumed at frame n does frames - n more
+    const struct chip8_state* state = NULL;
+    if(load_state)
+    {
+        state = chip8_state_map(load_state);
+        if(!state)
+        {
+            printf("Failed to load state %s\n", load_state);
+            return -1;
+        }
+        chip8_state_restore(&chip8, state);
+    }
+
+    // Playback overrides --seed with the RNG state the movie was recorded with
+    struct chip8_movie movie;
+    chip8_movie_init(&movie);
+    if(play)
+    {
+        if(!chip8_movie_load(&movie, play))
+        {
+            printf("Failed to load movie %s\n", play);
+            return -1;
+        }
+        chip8_movie_start(&movie, &chip8);
+    }
+    else if(record)
+    {
+        chip8_movie_begin(&movie, &chip8);
+        chip8.movie = &movie;
+    }
+
+    if(!chip8_set_engine(&chip8, engine))
+        printf("JIT is not available, using the interpreter\n");
+
+    // Lockstep lanes are not counted
+    struct chip8_telemetry telemetry;
+    struct chip8_telemetry_reporter reporter;
+    chip8_telemetry_init(&telemetry);
+    chip8.telemetry = &telemetry;
+    if(telemetry_target && !chip8_telemetry_reporter_start(&reporter, &telemetry, telemetry_target, 100))
+    {
+        printf("Failed to open telemetry %s\n", telemetry_target);
+        return -1;
+    }
+
+    struct chip8_pacer pacer;
+    chip8_pacer_init(&pacer, CHIP8_FRAMES_PER_SECOND);
+
+    struct timespec tstart = { 0,0 }, tend = { 0,0 };
+    clock_gettime(CLOCK_MONOTONIC, &tstart);
+
+    // Lockstep runs every lane with its own seed, seed + lane, and reports on lane 0
+    struct chip8_lockstep* lanes = NULL;
+    unsigned long long total_cycles = 0;
+    if(lockstep)
+    {
+        lanes = malloc(sizeof(struct chip8_lockstep));
+        chip8_lockstep_init(lanes, &chip8);
+        for(i = 0; i < CHIP8_LOCKSTEP_LANES; i++)
+            chip8_lockstep_seed(lanes, i, seed + i);
+    }
+
+    struct lockstep_check* check = NULL;
+    int mismatch = -1;
+    if(lockstep_checked)
+    {
+        check = malloc(sizeof(struct lockstep_check));
+        if(!check || !lockstep_check_init(check, filename, seed, chip8.engine))
+        {
+            printf("Failed to set up the lockstep check\n");
+            return -1;
+        }
+    }
+
+    // The snapshot check saves every frame, runs a few frames ahead and rolls
+    // them back before running the frame for real, the way rollback netcode
+    // does. The result has to match a run that never rolled back
+    struct chip8_snapshot* snapshot = NULL;
+    if(snapshot_check)
+    {
+        snapshot = malloc(sizeof(struct chip8_snapshot));
+        chip8_snapshot_init(snapshot, &chip8);
+    }
+
+    // Nobody answers Fx0A here, a waiting ROM just idles out its frames
+    while((lanes ? lanes->frames : chip8.frames) < frames)
+    {
+        if(check)
+        {
+            mismatch = lockstep_check_frame(check, lanes, frames);
+            if(mismatch != -1)
+                break;
+        }
+        else if(lanes)
+            chip8_lockstep_run_frame(lanes);
+        else if(snapshot)
+        {
+            chip8_snapshot_save(snapshot, &chip8);
+            int ahead;
+            for(ahead = 0; ahead < HEADLESS_SNAPSHOT_CHECK_AHEAD; ahead++)
+                chip8_run(&chip8, chip8.cycles_per_frame);
+            chip8_snapshot_restore(snapshot, &chip8);
+            chip8_run(&chip8, chip8.cycles_per_frame);
+        }
+        else
+        {
+            if(play)
+                chip8_movie_play(&movie, &chip8);
+            chip8_run(&chip8, chip8.cycles_per_frame);
+        }
+
+        if(paced)
+            chip8_pacer_wait(&pacer);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tend);
+    if(telemetry_target)
+        chip8_telemetry_reporter_stop(&reporter);
+
+    double elapsed = ((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - ((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec);
+
+    total_cycles = chip8.cycles;
+    if(lanes)
+    {
+        chip8_lockstep_extract(lanes, 0, &chip8);
+        total_cycles = lanes->cycles * CHIP8_LOCKSTEP_LANES;
+    }
+
+    if(chip8.memory.failed)
+    {
+        printf("Out of memory, writes to %s were dropped\n", filename);
+        return -1;
+    }
+
+    printf("rom %s\n", filename);
+    printf("frames %llu\n", chip8.frames);
+    printf("cycles %llu\n", total_cycles);
+    printf("seconds %.6f\n", elapsed);
+    printf("instructions/s %.0f\n", elapsed > 0 ? total_cycles / elapsed : 0.0);
+    if(lanes)
+    {
+        unsigned long long executed = lanes->vector_instructions + lanes->scalar_instructions;
+        printf("lanes %d\n", CHIP8_LOCKSTEP_LANES);
+        printf("vector %.1f%%\n", executed ? 100.0 * lanes->vector_instructions / executed : 0.0);
+        free(lanes);
+    }
+    printf("screen %016llx\n", chip8_screen_hash(&chip8.screen));
+
+    bool failed = false;
+    if(check)
+    {
+        failed = mismatch != -1;
+        if(failed)
+            printf("lockstep lane %d differs at frame %llu\n", mismatch, check->lane->frames);
+        else
+            printf("lockstep ok\n");
+        lockstep_check_destroy(check);
+        free(check);
+    }
+    if(snapshot)
+    {
+        failed = !matches_straight_run(&chip8, filename, seed, chip8.engine);
+        printf("snapshot %s\n", failed ? "differs" : "ok");
+        free(snapshot);
+    }
+
+    if(save_state && !chip8_state_save(&chip8, save_state))
+        printf("Failed to save state %s\n", save_state);
+    if(play && !chip8_movie_is_done(&movie))
+        printf("movie %d events left\n", movie.total_events - movie.next);
+    if(record && !chip8_movie_save(&movie, record))
+        printf("Failed to save movie %s\n", record);
+    chip8_movie_destroy(&movie);
+
+    chip8_destroy(&chip8);
+    if(state)
+        chip8_state_unmap(state);
+    return failed ? 1 : 0;
+}
@@ -4,9 +4,10 @@
 #include "SDL2/SDL_ttf.h"
 
 #include "chip8.h"
+#include "chip8_pacer.h"
 
 
-const char keyboard_map[CHIP8_TOTAL_KEYS] = {
+const int keyboard_map[CHIP8_TOTAL_KEYS] = {
     SDLK_0, SDLK_1, SDLK_2, SDLK_3, SDLK_4, SDLK_5,
     SDLK_6, SDLK_7, SDLK_8, SDLK_9, SDLK_a, SDLK_b,
     SDLK_c, SDLK_d, SDLK_e, SDLK_f};
@@ -118,8 +119,16 @@ int main(int argc, char** argv)
     }
 
     struct chip8 chip8;
-    chip8_init(&chip8);
-    chip8_load(&chip8, buf, size);
+    if(!chip8_init(&chip8))
+    {
+        printf("Failed to initialize the machine");
+        return -1;
+    }
+    if(!chip8_load(&chip8, buf, size))
+    {
+        printf("Failed to load the program");
+        return -1;
+    }
     chip8_keyboard_set_map(&chip8.keyboard, keyboard_map);
 
     
@@ -138,18 +147,11 @@ int main(int argc, char** argv)
     //TTF_Font* sans = TTF_OpenFont("arial.ttf", 24); //this opens a font style and sets a size
     
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_TEXTUREACCESS_TARGET);
-    Uint64 NOW = SDL_GetPerformanceCounter();
-    Uint64 LAST = 0;
-    double deltaTime = 0;
-    double frame = 0;
+    struct chip8_pacer pacer;
+    chip8_pacer_init(&pacer, CHIP8_FRAMES_PER_SECOND);
 
     while(1){
 
-        LAST = NOW;
-        NOW = SDL_GetPerformanceCounter();
-
-        deltaTime = (double)((NOW - LAST)*1000 / (double)SDL_GetPerformanceFrequency() );
-
         SDL_Event event;
         while(SDL_PollEvent(&event)){
 
@@ -161,16 +163,14 @@ int main(int argc, char** argv)
                 break;
 
                 case SDL_KEYDOWN:{
-                    char key = event.key.keysym.sym;
-                    int vkey = chip8_keyboard_map(&chip8.keyboard, key);
+                    int vkey = chip8_keyboard_map(&chip8.keyboard, event.key.keysym.sym);
                     if(vkey != -1)
                         chip8_keyboard_down(&chip8.keyboard, vkey);
                 }
                 break;
 
                 case SDL_KEYUP:{
-                    char key = event.key.keysym.sym;
-                    int vkey = chip8_keyboard_map(&chip8.keyboard, key);
+                    int vkey = chip8_keyboard_map(&chip8.keyboard, event.key.keysym.sym);
                     if(vkey != -1)
                         chip8_keyboard_up(&chip8.keyboard, vkey);
                 }
@@ -208,49 +208,33 @@ int main(int argc, char** argv)
             chip8.registers.delay_timer--;
         }
         */
-        if(chip8.registers.sound_timer > 0){
-            //Beep(15000, 100 * chip8.registers.sound_timer);
-            chip8.registers.sound_timer = 0;
-        }
-
-        if(frame > 4){
-
-            if(chip8.registers.delay_timer > 0)
-                chip8.registers.delay_timer--;
-            else{
-                unsigned short opcode = chip8_memory_get_short(&chip8.memory, chip8.registers.PC);
-                chip8.registers.PC += 2;
-                chip8_exec(&chip8, opcode);
-            }
-            frame = 0;
+        // One emulated frame per deadline
+        chip8_run(&chip8, chip8.cycles_per_frame);
 
 
-            
-            COORD pos = {0, 0};
-            SetConsoleCursorPosition(hConsole, pos);
-
+        
+        COORD pos = {0, 0};
+        SetConsoleCursorPosition(hConsole, pos);
 
-            int i = 0;
-            for(i = 0; i < 12; i++)            
-                printf(" V%02d|", i);
-            printf("\n");
 
-            for(i = 0; i < 12; i++)            
-                printf(" %02x |", chip8.registers.V[i]);
+        int i = 0;
+        for(i = 0; i < 12; i++)            
+            printf(" V%02d|", i);
+        printf("\n");
 
-            printf("\n\n");
+        for(i = 0; i < 12; i++)            
+            printf(" %02x |", chip8.registers.V[i]);
 
-            printf("  I   | dt | st |  PC  | SP |\n");
-            printf(" %04x |", chip8.registers.I);
-            printf(" %02x |", chip8.registers.delay_timer);
-            printf(" %02x |", chip8.registers.sound_timer);
-            printf(" %04x |", chip8.registers.PC);
-            printf(" %02x |", chip8.registers.SP);
-            
-        }
+        printf("\n\n");
 
-        frame += deltaTime;
+        printf("  I   | dt | st |  PC  | SP |\n");
+        printf(" %04x |", chip8.registers.I);
+        printf(" %02x |", chip8.registers.delay_timer);
+        printf(" %02x |", chip8.registers.sound_timer);
+        printf(" %04x |", chip8.registers.PC);
+        printf(" %02x |", chip8.registers.SP);
 
+        chip8_pacer_wait(&pacer);
     }
 
 out: